@@ -0,0 +1,61 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Library interface of the calculator compiler. Build project_one.c with -DCOMPILER_NO_MAIN
+// and -pthread to link it into another program. Each Compiler is independent, so separate
+// threads may use separate compilers at once, but one compiler must not be shared between them.
+
+// Command line switches. A zero field leaves the corresponding pass off.
+typedef struct _OPTIONS {
+	int discard; // generate no text, which is handy for benchmarking
+	int peephole; // window size of the peephole optimizer
+	int regs; // number of machine registers for the register allocator
+	int gvn; // value numbering across statements
+	int sink; // keep variables in registers and store each one once
+	int constprop; // fold values known at compile time across statements
+	int simplify; // algebraic identities on the AST
+	int reassoc; // regroup + - and * chains to fold their constants
+	int cse; // evaluate the equal side-effect free subtrees of a statement once
+	int simulate; // run the generated code on a simulated machine
+	int sim_init[3]; // values of [0], [4] and [8] when the simulated program starts
+	int latency[7]; // cycles each opcode takes on the target, 0 for the default
+	int width; // instructions the target issues per cycle, 0 for 1
+	int schedule; // reorder the instructions of each statement to hide latencies
+	int stats; // time the phases and count their work: 1 for the whole input, 2 for every statement too
+	int cache; // statements whose code the compilation cache keeps
+} Options;
+
+// Everything one compilation owns, see project_one.c.
+typedef struct _COMPILER Compiler;
+
+// Results of compiler_compile_line.
+enum {
+	COMPILER_OK, // the statement was compiled
+	COMPILER_ERROR // the statement is malformed; no code was generated for it
+};
+
+// Create a compiler with the passes of "opt", or none when "opt" is NULL. Its output is kept
+// in memory for compiler_read. Return NULL when out of memory.
+Compiler *compiler_create(const Options *opt);
+// Compile the statement made of the "n" bytes at "line". Variables keep their values from the
+// statements compiled before, also after a statement that failed.
+int compiler_compile_line(Compiler *c, const char *line, size_t n);
+// Generate the code the optimizers still hold back. Call it once after the last statement.
+void compiler_finish(Compiler *c);
+// Copy at most "cap" bytes of the assembly generated so far into "buf" and drop them from the
+// compiler. Return the number of bytes copied, 0 once everything has been read.
+size_t compiler_read(Compiler *c, char *buf, size_t cap);
+// Release "c" and everything it holds.
+void compiler_destroy(Compiler *c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
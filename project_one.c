@@ -1,9 +1,22 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
-#include <ctype.h>
-
-#define MAX_LENGTH 100
+#include <limits.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LEXER_SIMD
+#include <immintrin.h>
+#endif
+#include "compiler.h"
 
 // Token / AST kinds
 enum {
@@ -22,7 +35,8 @@ enum {
 	/// Precedence 14
 	Assign
 };
-const char TYPE[20][20] = {
+#ifdef AST_DEBUG
+static const char TYPE[20][20] = {
 	"LPar", "RPar",
 	"Value", "Variable",
 	"PostInc", "PostDec",
@@ -31,956 +45,4302 @@ const char TYPE[20][20] = {
 	"Add", "Sub",
 	"Assign"
 };
+#endif
 typedef struct _TOKEN {
 	int kind;
 	int param; // Value, Variable, or Parentheses label
-	struct _TOKEN *prev, *next;
+	int pair; // Index of the matching parenthesis, filled by lexer
 } Token;
-typedef struct _AST {
-	int type;
-	int val; // Value or Variable
-	struct _AST *lhs, *rhs, *mid;
-} AST;
+// Growable token array. The lexer appends into it and it is reused for every statement.
+typedef struct _TOKEN_BUF {
+	Token *arr;
+	int len, cap;
+} TokenBuf;
+// Scanning kernels of the lexer. scanner_init picks the widest ones the CPU runs.
+typedef struct _SCANNER {
+	// Index of the first byte from "i" on that is not a blank, or "n".
+	size_t (*skip_space)(const char *in, size_t i, size_t n);
+	// Index of the first byte from "i" on that is not a digit, or "n".
+	size_t (*skip_digit)(const char *in, size_t i, size_t n);
+} Scanner;
+// A node of the AST is an index into the pool of its statement. Node 0 stands for no node, so a
+// child of 0 is a missing one.
+typedef int32_t Node;
+// AST of the statement being compiled, as a struct of arrays carved out of one block. A node
+// takes 17 bytes, and the walks of the passes read the few arrays they need front to back.
+typedef struct _AST_POOL {
+	Node *lhs, *mid, *rhs;
+	int32_t *val; // Value or Variable
+	uint8_t *type;
+	int len, cap;
+} AstPool;
+// Fields of node "n" of the statement compiled by "c", which must be in scope. They are lvalues,
+// but one must not be assigned the result of a call that may add nodes, since that can move the pool.
+#define KIND(n) (c->ast.type[n])
+#define VAL(n) (c->ast.val[n])
+#define LHS(n) (c->ast.lhs[n])
+#define MID(n) (c->ast.mid[n])
+#define RHS(n) (c->ast.rhs[n])
+// Variable number of a Variable node once turn_to_reg put the register holding it in "val".
+// Operands have no children, so the number takes the place of the left one. No walk reads it
+// as a child: the rewriting passes run before turn_to_reg sets it, the walks after it don't
+// descend into operands, and codegen copies it along with "val" wherever a node collapses
+// into its operand.
+#define VAR(n) (c->ast.lhs[n])
+// Register of a variable in "val", -1 if it has none, and in "loaded" the statement that
+// loaded it into that register, see Compiler.line.
+typedef struct _VAR_REG {
+	int loaded;
+	int val;
+} VarReg;
+// Memory slot of variable number "v". Slots are words, so x, y and z keep [0], [4] and [8].
+#define VAR_SLOT(v) (4 * (v))
+// Name of a variable: "len" bytes at "name" in the text of the symbol table.
+typedef struct _SYMBOL {
+	int name, len;
+} Symbol;
+// Names of the variables, by number, and an open-addressing table that finds the number of
+// a name.
+typedef struct _SYMBOLS {
+	Symbol *arr; int len, cap;
+	char *text; int text_len, text_cap;
+	int *table; unsigned mask; // variable number + 1 by hash of the name, 0 where empty
+} Symbols;
+// One level of an iterative tree walk: the node and how far the walk of it got.
+typedef struct _FRAME {
+	Node node;
+	int state;
+	int r; // parser: last token of the expression; reassoc: number of terms of a chain
+	int level; // parser: loosest operator the expression takes, or the closing parenthesis
+} Frame;
+// Frame kinds of the parser: an expression, whose "node" is the operator waiting for its right
+// operand, and a prefix operator and a parenthesis pair waiting for theirs.
+enum {
+	FrameExpr, FramePrefix, FramePar
+};
+// Explicit stack of the parser and the tree walks, reused for every statement. The nesting
+// depth of an expression is limited by memory rather than by the C stack.
+typedef struct _FRAME_STACK {
+	Frame *arr;
+	int len, cap;
+} FrameStack;
+// Bump-pointer arena. Scratch memory the passes need for one statement is carved out of
+// its blocks and released together by arena_reset.
+#define ARENA_BLOCK_SIZE 65536
+typedef struct _ARENA_BLOCK {
+	struct _ARENA_BLOCK *next;
+	size_t size, used;
+	char data[];
+} ArenaBlock;
+typedef struct _ARENA {
+	ArenaBlock *head, *cur;
+	long allocs; // calls to arena_alloc
+} Arena;
+// Opcodes of the target assembly
+enum {
+	OpLoad, OpStore, OpAdd, OpSub, OpMul, OpDiv, OpRem
+};
+static const char OPNAME[7][6] = {
+	"load", "store", "add", "sub", "mul", "div", "rem"
+};
+// Operand kinds: "rN", "N", and "[N]"
+enum {
+	OpdNone, OpdReg, OpdImm, OpdMem
+};
+typedef struct _OPERAND {
+	int kind;
+	int val;
+} Operand;
+static const Operand opd_none = {OpdNone, 0};
+// One three-address instruction "op d a b". Unused operands are opd_none.
+typedef struct _INSTR {
+	int op;
+	Operand d, a, b;
+} Instr;
+// Instruction stream produced by turn_to_reg and codegen, printed by ir_flush.
+typedef struct _IR {
+	Instr *arr;
+	int len, cap;
+} IR;
+// Outcome of register allocation, reported at exit.
+typedef struct _REGALLOC_REPORT {
+	int peak; // most values live at once
+	int spilled; // values kept in memory
+	int slots; // spill slots used beyond [8]
+} RegallocReport;
+// Outcome of store sinking, reported at exit.
+typedef struct _SINK_REPORT {
+	long stores; // stores overwritten before being read
+	long loads; // loads of a value some register still held
+} SinkReport;
+// One available expression "op a b", whose value number is "vn" and which register "holder" keeps.
+// Register operands are keyed by their value number. An empty entry has op 0, which is OpLoad.
+typedef struct _GVN_ENTRY {
+	int op, ka, a, kb, b;
+	int vn, holder;
+} GvnEntry;
+// Value numbering state carried from statement to statement.
+#define GVN_TABLE_SIZE 4096
+typedef struct _GVN {
+	int *name, name_cap; // register every codegen register number currently stands for, by number + 1
+	int *vn, vn_cap; // value number held by every renamed register
+	int *mem, mem_cap; // value number stored in every memory slot, -1 if not known
+	int next_name, next_vn;
+	GvnEntry table[GVN_TABLE_SIZE];
+} Gvn;
+// Lattice value of a register or memory slot: a known constant, or not constant.
+typedef struct _CONST_VALUE {
+	int known;
+	int val;
+} ConstValue;
+// Constant propagation state carried from statement to statement.
+typedef struct _CONST_PROP {
+	ConstValue *reg; int reg_cap; // by register number + 1
+	ConstValue *mem; int mem_cap; // by memory slot
+} ConstProp;
+// Instructions are formatted into "buf" and written to "fd" in large chunks.
+// With "discard" set nothing is written, which is handy for benchmarking.
+// With "fd" -1 the text is kept in "mem" until compiler_read takes it.
+#define EMIT_BUF_SIZE 65536
+typedef struct _EMITTER {
+	char buf[EMIT_BUF_SIZE];
+	size_t len;
+	int fd;
+	int discard;
+	char *mem;
+	size_t mem_len, mem_cap, mem_read;
+} Emitter;
+// Timing of the target, which the scheduler plans for and the simulator runs.
+typedef struct _MACHINE_DESC {
+	int latency[7]; // cycles from issue until the result is ready, by opcode
+	int width; // instructions issued per cycle
+} MachineDesc;
+// Simulated machine. Registers and memory slots hold a value once written, and each one
+// also remembers the cycle its value is ready in.
+typedef struct _MACHINE {
+	int *reg; char *reg_set; long *reg_ready; int reg_cap; // by register number
+	int *mem; char *mem_set; long *mem_ready; int mem_cap; // by memory slot
+	MachineDesc desc;
+	long issue; // cycle the last instruction issued in
+	int issued; // instructions issued in that cycle
+} Machine;
+// What the simulator saw, reported at exit.
+typedef struct _SIM_REPORT {
+	long instrs; // instructions executed
+	long cycles; // cycle the last result is ready in
+	long stalls; // cycles instructions waited for their operands
+	long faults; // reads of unset registers or slots, stores to bad slots, divisions by zero
+} SimReport;
+// Outcome of scheduling, reported at exit. Stalls are those the machine description predicts
+// for each statement on its own.
+typedef struct _SCHEDULE_REPORT {
+	long moved; // instructions that changed places
+	long before, after; // stall cycles of the statements in the order generated and scheduled
+} ScheduleReport;
+// Phases timed by --stats, in the order they run. "cache" is looking statements up in the
+// compilation cache and replaying them, "optimize" the IR passes, and "emit" the simulator
+// and the assembly text.
+enum {
+	PhaseLexer, PhaseCache, PhaseParser, PhaseSemantic, PhaseSimplify, PhaseReassoc, PhaseCse,
+	PhaseTurnToReg, PhaseCodegen, PhaseSchedule, PhaseOptimize, PhaseEmit, PHASES
+};
+static const char PHASENAME[PHASES][16] = {
+	"lexer", "cache", "parser", "semantic_check", "simplify", "reassoc", "cse",
+	"turn_to_reg", "codegen", "schedule", "optimize", "emit"
+};
+// Work done by the phases, reported by --stats.
+typedef struct _STATS {
+	long statements; // non-blank lines compiled
+	long ns[PHASES]; // wall time by phase
+	long tokens;
+	long ast_nodes;
+	long allocs; // arena allocations, and the times the AST pool grew
+	long regs; // registers consumed
+	long max_reg; // highest register number plus one
+	long generated[7]; // instructions codegen produced, by opcode
+	long emitted[7]; // instructions printed after the optimizers, by opcode
+} Stats;
+// The code one statement generated, for statements made of the same tokens whose variables
+// start out in registers shared alike. Registers are relative: CACHE_STORE(i) is the register
+// the i-th variable of the statement starts in, and n >= 0 the n-th fresh register.
+#define CACHE_STORE(i) (-2 - (i))
+typedef struct _CACHE_ENTRY {
+	unsigned hash;
+	Token *tokens; int ntokens;
+	int nvars; // variables of the statement
+	int *in; // how they shared registers when the statement started, 2 numbers each, see cache_shape
+	int *out; // register of each variable when the statement ends, in the block of "in"
+	Instr *code; int ncode;
+	int fresh; // registers the statement took
+	int simplify, reassoc, cse; // rewrites its passes made
+	ScheduleReport schedule; // what scheduling it did
+	int chain; // next entry of the hash bucket
+	int prev, next; // neighbours in the order of use, most recent first
+} CacheEntry;
+// Compilation cache, at most "cap" entries of which the least recently used is dropped first.
+typedef struct _CACHE {
+	CacheEntry *entry; int len, cap;
+	int *bucket; unsigned mask;
+	int head, tail; // most and least recently used entries
+	// The variables of the statement being compiled in the order they first appear, the
+	// register each one starts in and its shape. "listed" holds the number of the statement
+	// that listed a variable last, by variable number.
+	int *vars, *in, *shape, nvars, vars_cap;
+	int *listed, listed_cap;
+} Cache;
+typedef struct _CACHE_REPORT {
+	long hits, misses, evictions;
+} CacheReport;
+// Counters of the optional passes, reported at exit.
+typedef struct _REPORT {
+	long simplify; // identities applied
+	long reassoc; // constants folded away by reassociation
+	long cse; // subtrees merged
+	long constprop; // instructions folded
+	long gvn; // values reused
+	long peephole; // instructions removed
+	SinkReport sink;
+	RegallocReport regalloc;
+	SimReport sim;
+	ScheduleReport schedule;
+	CacheReport cache;
+	Stats stats;
+} Report;
+// Everything one compilation owns. Compilers share nothing, so several of them can run at once.
+struct _COMPILER {
+	Options opt;
+	Arena arena;
+	TokenBuf tokens;
+	Scanner scan;
+	AstPool ast;
+	FrameStack frames;
+	IR ir;
+	int ir_done; // instructions before this index have been through constprop and gvn
+	ConstProp constprop;
+	Gvn gvn;
+	Machine machine;
+	Cache cache;
+	Report report;
+	Stats stats_mark; // "report.stats" when the statement started
+	int reg; // next free register
+	int line; // statements compile_line began
+	Symbols sym; // names of the variables
+	VarReg *store; // register of every variable, by variable number
+	int *holders, holders_cap; // variables in every register, by register number
+	int var_top; // highest register a variable is in, -1 if none
+	Node first; // root of the statement in codegen
+	uint8_t *shared; // marks of the nodes of the statement when cse made it a DAG, else NULL
+	uint8_t *pure; int npure; // nodes of the statement that change no variable, see mark_pure
+	char *input; // line buffer for stdin, grown to fit the longest statement
+	size_t input_cap;
+	jmp_buf fail; // where err() returns to
+	Emitter out;
+};
 // Utility Interface
 
-// Function called when an unexpected expression occurs.
-void err();
-// Used to create a new Token.
-Token *new_token(int kind, int param);
+// Function called when an unexpected expression occurs. It returns to the compile_text,
+// compile_stream or compiler_compile_line call running, before the statement generated any code.
+static void err(Compiler *c);
+// Allocate "size" bytes from the arena. The memory lives until the next arena_reset.
+static void *arena_alloc(Arena *a, size_t size);
+// Release everything allocated from the arena. Blocks are kept for reuse.
+static void arena_reset(Arena *a);
+// Build an operand of the given kind.
+static Operand opd_reg(int r);
+static Operand opd_imm(int v);
+static Operand opd_mem(int m);
+// Return the operand that holds the value of a generated node.
+static Operand node_operand(Compiler *c, Node ast);
+// Instruction of the binary operator "kind".
+static int binary_op(int kind);
+// Compute "a op b" with the machine's 32-bit wraparound into "res".
+// Return 0 for a division that would trap, which is left for the machine to run.
+static int const_eval(int op, int a, int b, int *res);
+// Append the instruction "op d a b" to the IR.
+static void ir_append(Compiler *c, int op, Operand d, Operand a, Operand b);
+// Append the instruction "op d a b" to "ir".
+static void ir_push(IR *ir, int op, Operand d, Operand a, Operand b);
+// Print the IR in assembly text form and empty it, except for the last "keep" instructions.
+static void ir_flush(Compiler *c, int keep);
+// Append the instruction "op d a b" to the buffer of "out". Unused operands are opd_none.
+static void emit(Emitter *out, int op, Operand d, Operand a, Operand b);
+// Write the buffer of "out" out.
+static void emit_flush(Emitter *out);
+// Write all "n" bytes of "buf" to "fd".
+static void write_all(int fd, const char *buf, size_t n);
+// Choose the scanning kernels of the lexer for the CPU the program runs on.
+static void scanner_init(Scanner *s);
+// Used to append a new Token to the token buffer.
+static Token *new_token(Compiler *c, int kind, int param);
 // Used to create a new AST node.
-AST *new_AST(Token *mid);
-// Convert Token linked list into array form.
-int list_to_arr(Token **head);
+static Node new_AST(Compiler *c, Token *mid);
 // Use to check if the kind can be determined as a value section.
-int isBinaryOperator(int kind);
+static int isBinaryOperator(int kind);
 // Pass "kind" as parameter. Return true if it is an operator kind.
-int isOp(int x);
+static int isOp(int x);
 // Pass "kind" as parameter. Return true if it is an unary kind.
 // unary contains increment, decrement, plus, and minus.
-int isUnary(int x);
+static int isUnary(int x);
 // Pass "kind" as parameter. Return true if it is a parentheses kind.
-int isPar(int x);
+static int isPar(int x);
 // Pass "kind" as parameter. Return true if it is a plus or minus.
-int isPlusMinus(int x);
+static int isPlusMinus(int x);
 // Pass "kind" as parameter. Return true if it is an operand(value or variable).
-int isOperand(int x);
+static int isOperand(int x);
 // Return the precedence of a kind. If doesn't have precedence, return -1.
-int getOpLevel(int kind);
-// Given the position of left parthesis, find the right part in range [tar,r]. If not found, return -1.
-int findParPair(Token *arr, int tar, int r);
-// Parse the expression the the next section. A section means a Value, Variable, or a parenthesis pair.
-int nextSection(Token *arr, int l, int r);
-// Used to find a appropriate operator that split the expression half.
-int find_Tmid(Token *arr, int l, int r);
-// Determine the memory location of variable
-int var_memory(AST *ast);
+static int getOpLevel(int kind);
+// Wrap "node" in the postfix operators from "*pos" up to "r".
+static Node parse_postfix(Compiler *c, Token *arr, int *pos, int r, Node node);
+// Memory slot of the variable at "ast", or under the operators and parentheses at "ast", once
+// turn_to_reg gave it a register.
+static int var_memory(Compiler *c, Node ast);
+// Number of the variable named by the "n" bytes at "name", which is new if no variable has that name.
+static int sym_intern(Compiler *c, const char *name, size_t n);
+// Put variable "v" in register "r", or in none for -1.
+static void var_set_reg(Compiler *c, int v, int r);
+
 
+// Optimization Interface
+
+// Rewrite or remove wasteful instruction sequences in "ir". Patterns look at most "window"
+// instructions ahead. "final" tells that no code follows "ir". Return the number of removed instructions.
+static int peephole(IR *ir, int window, int final);
+// Rewrite the tree at "*ast" with algebraic identities such as e*1, e+0, e*0 and e-e, leaving
+// every ++ and -- in place. Return the number of rewrites.
+static int simplify(Compiler *c, Node *ast);
+// Flatten the Add/Sub and Mul chains of the tree at "*ast", fold their constants into one,
+// and rebuild each chain left-leaning. Return the number of constants folded away.
+static int reassoc(Compiler *c, Node *ast);
+// Make the equal Add, Sub, Mul, Div and Rem subtrees of the tree at "*ast" that change no
+// variable one node, turning it into a DAG, and drop the parentheses around them. Return the
+// number of subtrees merged.
+static int cse(Compiler *c, Node *ast);
+// Map the unbounded register numbers of "ir" onto "nregs" machine registers with linear scan.
+// Values that don't fit live in memory slots from "base" on, which is past the variables.
+static void regalloc(IR *ir, int nregs, int base, RegallocReport *rep);
+// Value-number the instructions of "ir" from "from" on. Every definition gets a register of its own
+// so values stay available, and an expression whose value some register already holds is dropped
+// in favor of that register. Return the number of dropped instructions.
+static int gvn(Gvn *g, IR *ir, int from);
+// Replace the instructions of "ir" from "from" on whose value is known at compile time by
+// "mul rD c 1", and operands known to be constant by immediates. Return the number of folded instructions.
+static int constprop(ConstProp *c, IR *ir, int from);
+// Run instruction "x" on "m". Instructions issue in order, as many per cycle as the width of its
+// description, and each waits until its operands are ready; its result is ready "latency" cycles
+// after it issues.
+static void simulate(Machine *m, Instr *x, SimReport *rep);
+#ifndef COMPILER_NO_MAIN
+// Print the memory image of "m" to stderr.
+static void machine_print(Machine *m);
+#endif
+// Reorder the "n" instructions of one statement at "code" so that independent ones issue in the
+// cycles "desc" would otherwise stall for, keeping every register and memory slot written and
+// read in the same order. The order is kept when it doesn't lose fewer cycles. Scratch memory
+// comes from "a".
+static void schedule(const MachineDesc *desc, Instr *code, int n, Arena *a, ScheduleReport *rep);
+// Keep variable values in the registers that computed them across the whole program "ir":
+// loads read those registers instead, and only stores that are read or last are kept.
+static void sink_stores(IR *ir, SinkReport *rep);
 
 // Debug Interface
 
-// Print the AST. You may set the indent as 0.
-void AST_print(AST *head, int indent);
+// Print the AST. You may set the indent as 0. Define AST_DEBUG to print every statement's.
+#ifdef AST_DEBUG
+static void AST_print(Compiler *c, Node head, int indent);
+#endif
 
 // Main Function
 
-char input[MAX_LENGTH];
-
-// Convert the inputted string into multiple tokens.
-Token *lexer(char *in);
+// Set up "c" to compile with "opt" and write the assembly to "fd".
+static void compiler_init(Compiler *c, const Options *opt, int fd);
+// Release everything "c" holds.
+static void compiler_free(Compiler *c);
+// Print the code still held back once the input has ended.
+void compiler_finish(Compiler *c);
+// Compile one statement made of the "n" bytes at "in".
+static void compile_line(Compiler *c, const char *in, size_t n);
+// Translate the "n" tokens at "arr" into instructions, from the parser down to codegen.
+// "t" is the time the phase before ended, and the time codegen ended is returned.
+static long translate(Compiler *c, Token *arr, int n, long t);
+// Entry of the cache of "c" for the "n" tokens at "arr" with the variables in the registers
+// they are in now, or NULL. It lists the variables of the statement for cache_insert.
+static CacheEntry *cache_find(Compiler *c, const Token *arr, int n);
+// Append the code of "e" to the IR of "c", and leave the variables in the registers it leaves them in.
+static void cache_replay(Compiler *c, CacheEntry *e);
+// Remember the code generated from the instruction "from" on for the "n" tokens at "arr", which
+// cache_find looked up, when the next free register was "base". "sched" is what scheduling
+// did to that code.
+static void cache_insert(Compiler *c, const Token *arr, int n, int base, int from, int simplify, int reassoc,
+	int cse, const ScheduleReport *sched);
+// Release everything "cache" holds.
+static void cache_free(Cache *cache);
+#ifndef COMPILER_NO_MAIN
+// Print the code generated so far and "Compile Error!", which ends the output of the command line modes.
+static void print_error(Compiler *c);
+// Compile the "n" bytes at "data" line by line. Return 0, or 1 after a compile error.
+static int compile_text(Compiler *c, const char *data, size_t n);
+// Compile every line read from "in". Return 0, or 1 after a compile error.
+static int compile_stream(Compiler *c, FILE *in);
+// Map the file at "path" into memory and compile it line by line without copying.
+// Return 0, 1 after a compile error, or -1 if the file can't be read.
+static int compile_file(Compiler *c, const char *path);
+// Compile every file of "path" into "<file>.s" on "jobs" threads. Return the number of files that failed to be read or written.
+static int compile_batch(const Options *opt, char **path, int n, int jobs, Report *total);
+// Compile the corpora generated from "seed" with "opt", the mixed program being "lines" long,
+// and print the throughput of each. Return 1 if a corpus failed to compile.
+static int bench(const Options *opt, unsigned seed, int lines);
+// Read a list such as "mul:4,div:30" into the "latency" table. Return 0 if it is malformed.
+static int parse_latency(const char *arg, int *latency);
+#endif
+// Wall clock in nanoseconds.
+static long now_ns(void);
+// Add the time since "start" to phase "phase" of "st" and return the time now.
+static long stats_phase(Stats *st, int phase, long start);
+// Print the counters of "st" but "statements" as the members of a JSON object to stderr.
+static void stats_print(const Stats *st);
+#ifndef COMPILER_NO_MAIN
+// Add the counters of "from" to "to".
+static void report_add(Report *to, const Report *from);
+// Print the counters of the passes enabled in "opt" to stderr.
+static void report_print(const Options *opt, const Report *rep);
+#endif
+// Convert the "n" inputted bytes into a token array. The number of tokens is stored in "len".
+static Token *lexer(Compiler *c, const char *in, size_t n, int *len);
 // Use tokens to build the binary expression tree.
-AST *parser(Token *arr, int l, int r);
+static Node parser(Compiler *c, Token *arr, int l, int r);
 // Checkif the expression(AST) is legal or not.
-void semantic_check(AST *now);
+static void semantic_check(Compiler *c, Node now);
 // Generate the ASM.
-void codegen(AST *ast);
-void turn_to_reg(AST **ast);
+static void codegen(Compiler *c, Node ast);
+// Generate the ASM of the prefix ++ or -- at "ast" and turn it into its operand.
+static void codegen_prefix(Compiler *c, Node ast);
+static void turn_to_reg(Compiler *c, Node *ast);
+// Give the variable at "now" the register of its value, loading it first if the statement hasn't.
+static void turn_to_reg_var(Compiler *c, Node now);
 
-int reg=0;
-AST store[]={{0, -1}, {0, -1}, {0, -1}};
-AST *first;
+#ifndef COMPILER_NO_MAIN
+int main(int argc, char **argv) {
+	Options opt = {0};
+	char **path = (char**)malloc(sizeof(char*) * argc);
+	int n = 0, jobs = 0, bench_lines = 1000000, run_bench = 0;
+	unsigned seed = 1;
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "--discard") == 0)
+			opt.discard = 1;
+		else if(strcmp(argv[i], "--peephole") == 0)
+			opt.peephole = 8;
+		else if(strncmp(argv[i], "--peephole=", 11) == 0 && atoi(argv[i] + 11) > 0)
+			opt.peephole = atoi(argv[i] + 11);
+		else if(strncmp(argv[i], "--regs=", 7) == 0 && atoi(argv[i] + 7) >= 2)
+			opt.regs = atoi(argv[i] + 7);
+		else if(strcmp(argv[i], "--gvn") == 0)
+			opt.gvn = 1;
+		else if(strcmp(argv[i], "--sink") == 0)
+			opt.sink = 1;
+		else if(strcmp(argv[i], "--constprop") == 0)
+			opt.constprop = 1;
+		else if(strcmp(argv[i], "--simplify") == 0)
+			opt.simplify = 1;
+		else if(strcmp(argv[i], "--reassoc") == 0)
+			opt.reassoc = 1;
+		else if(strcmp(argv[i], "--cse") == 0)
+			opt.cse = 1;
+		else if(strcmp(argv[i], "--simulate") == 0)
+			opt.simulate = 1;
+		else if(strncmp(argv[i], "--simulate=", 11) == 0 &&
+			sscanf(argv[i] + 11, "%d,%d,%d", &opt.sim_init[0], &opt.sim_init[1], &opt.sim_init[2]) == 3)
+			opt.simulate = 1;
+		else if(strncmp(argv[i], "--latency=", 10) == 0 && parse_latency(argv[i] + 10, opt.latency))
+			;
+		else if(strncmp(argv[i], "--width=", 8) == 0 && atoi(argv[i] + 8) > 0)
+			opt.width = atoi(argv[i] + 8);
+		else if(strcmp(argv[i], "--schedule") == 0)
+			opt.schedule = 1;
+		else if(strcmp(argv[i], "--cache") == 0)
+			opt.cache = 4096;
+		else if(strncmp(argv[i], "--cache=", 8) == 0 && atoi(argv[i] + 8) > 0)
+			opt.cache = atoi(argv[i] + 8);
+		else if(strcmp(argv[i], "--stats") == 0)
+			opt.stats = 1;
+		else if(strcmp(argv[i], "--stats=statements") == 0)
+			opt.stats = 2;
+		else if(strcmp(argv[i], "--bench") == 0)
+			run_bench = 1;
+		else if(strncmp(argv[i], "--bench=", 8) == 0 && sscanf(argv[i] + 8, "%u,%d", &seed, &bench_lines) >= 1 && bench_lines > 0)
+			run_bench = 1;
+		else if(strncmp(argv[i], "--jobs=", 7) == 0 && atoi(argv[i] + 7) > 0)
+			jobs = atoi(argv[i] + 7);
+		else if(argv[i][0] != '-')
+			path[n++] = argv[i];
+		else {
+			fprintf(stderr, "usage: %s [-n|--discard] [--peephole[=WINDOW]] [--regs=N] [--gvn] [--sink] [--constprop] [--simplify] [--reassoc] [--cse] [--simulate[=X,Y,Z]] [--latency=OP:N,...] [--width=N] [--schedule] [--stats[=statements]] [--cache[=ENTRIES]] [--jobs=N] [--bench[=SEED[,LINES]]] [file...]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(run_bench) {
+		free(path);
+		return bench(&opt, seed, bench_lines);
+	}
+	// Several files, or files and --jobs, compile each file into "<file>.s" in parallel. Without
+	// files, --jobs has nothing to spread and stdin is compiled as usual.
+	if(n > 1 || (n > 0 && jobs > 0)) {
+		Report total;
+		if(jobs == 0) jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		int failed = compile_batch(&opt, path, n, jobs > 0 ? jobs : 1, &total);
+		report_print(&opt, &total);
+		free(path);
+		return failed ? 1 : 0;
+	}
+	Compiler *c = (Compiler*)malloc(sizeof(Compiler));
+	if(c == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	compiler_init(c, &opt, 1);
+	int res = n == 1 ? compile_file(c, path[0]) : compile_stream(c, stdin);
+	if(res == -1)
+		exit(1);
+	if(res == 0)
+		compiler_finish(c);
+	// The program printed before a compile error still ran, and --stats shows how far the
+	// input got.
+	if(res == 0 || opt.simulate || opt.stats)
+		report_print(&opt, &c->report);
+	if(opt.simulate)
+		machine_print(&c->machine);
+	compiler_free(c);
+	free(c);
+	free(path);
+	return 0;
+}
+#endif
 
-int main() {
-	
-	while(fgets(input, MAX_LENGTH, stdin) != NULL) {
-		for(int i=0; i<3; i++)
-		{
-			store[i].type=0;
-		}
-		// build token list by lexer
-		Token *content = lexer(input);
-		// convert token list into array
-		int length = list_to_arr(&content);
-		// build abstract syntax tree by parser
-		AST *ast_root = parser(content, 0, length-1);
-        //AST_print(ast_root, 0);
-		// check if the syntax is correct
-		semantic_check(ast_root);
-		turn_to_reg(&ast_root);
-		// generate the assembly
-		first=ast_root;
-		codegen(ast_root);
-		int val=-1;
-		for(int i=0; i<3; i++)
-		{
-			if(store[i].val!=-1)
-			{
-				if(store[i].val>val)
-					val=store[i].val;
-			}
+static void compiler_init(Compiler *c, const Options *opt, int fd) {
+	memset(c, 0, sizeof(Compiler));
+	c->opt = *opt;
+	c->var_top = -1;
+	sym_intern(c, "x", 1);
+	sym_intern(c, "y", 1);
+	sym_intern(c, "z", 1);
+	c->out.fd = fd;
+	c->out.discard = opt->discard;
+	scanner_init(&c->scan);
+	static const int latency[7] = {3, 3, 1, 1, 3, 20, 20};
+	Machine *m = &c->machine;
+	for(int i = 0; i < 7; i++)
+		m->desc.latency[i] = opt->latency[i] > 0 ? opt->latency[i] : latency[i];
+	m->desc.width = opt->width > 0 ? opt->width : 1;
+	m->issued = m->desc.width;
+	if(opt->simulate) {
+		for(int i = 0; i < 3; i++) {
+			Instr set = {OpStore, opd_mem(4 * i), opd_imm(opt->sim_init[i]), opd_none};
+			simulate(m, &set, &c->report.sim);
+		}
+		// The first instruction of the program issues in cycle 1.
+		m->issue = 0;
+		m->issued = m->desc.width;
+		c->report.sim = (SimReport){0, 0, 0, 0};
+	}
+}
+
+static void compiler_free(Compiler *c) {
+	for(ArenaBlock *b = c->arena.head, *next; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+	free(c->tokens.arr);
+	free(c->ast.lhs);
+	free(c->frames.arr);
+	free(c->ir.arr);
+	free(c->constprop.reg);
+	free(c->constprop.mem);
+	free(c->gvn.name);
+	free(c->gvn.vn);
+	free(c->gvn.mem);
+	free(c->input);
+	free(c->sym.arr);
+	free(c->sym.text);
+	free(c->sym.table);
+	free(c->store);
+	free(c->holders);
+	free(c->out.mem);
+	Machine *m = &c->machine;
+	free(m->reg);
+	free(m->reg_set);
+	free(m->reg_ready);
+	free(m->mem);
+	free(m->mem_set);
+	free(m->mem_ready);
+	cache_free(&c->cache);
+}
+
+void compiler_finish(Compiler *c) {
+	ir_flush(c, 0);
+	emit_flush(&c->out);
+}
+
+Compiler *compiler_create(const Options *opt) {
+	static const Options none;
+	Compiler *c = (Compiler*)malloc(sizeof(Compiler));
+	if(c == NULL)
+		return NULL;
+	compiler_init(c, opt != NULL ? opt : &none, -1);
+	return c;
+}
+
+int compiler_compile_line(Compiler *c, const char *line, size_t n) {
+	if(setjmp(c->fail)) {
+		// Errors are found before codegen, so only the scratch memory of the statement is left to
+		// drop. Its AST goes when the next statement is parsed.
+		arena_reset(&c->arena);
+		return COMPILER_ERROR;
+	}
+	compile_line(c, line, n);
+	emit_flush(&c->out);
+	return COMPILER_OK;
+}
+
+size_t compiler_read(Compiler *c, char *buf, size_t cap) {
+	Emitter *out = &c->out;
+	size_t n = out->mem_len - out->mem_read;
+	if(n > cap) n = cap;
+	if(n == 0) return 0;
+	memcpy(buf, out->mem + out->mem_read, n);
+	out->mem_read += n;
+	if(out->mem_read == out->mem_len)
+		out->mem_len = out->mem_read = 0;
+	return n;
+}
+
+void compiler_destroy(Compiler *c) {
+	if(c == NULL) return;
+	compiler_free(c);
+	free(c);
+}
+
+#ifndef COMPILER_NO_MAIN
+static int parse_latency(const char *arg, int *latency) {
+	while(*arg) {
+		int op = 0, n, len;
+		while(op < 7 && !(strncmp(arg, OPNAME[op], strlen(OPNAME[op])) == 0 && arg[strlen(OPNAME[op])] == ':'))
+			op++;
+		if(op == 7 || sscanf(arg + strlen(OPNAME[op]) + 1, "%d%n", &n, &len) != 1 || n <= 0)
+			return 0;
+		latency[op] = n;
+		arg += strlen(OPNAME[op]) + 1 + len;
+		if(*arg == ',') arg++;
+		else if(*arg) return 0;
+	}
+	return 1;
+}
+
+static void report_add(Report *to, const Report *from) {
+	to->simplify += from->simplify;
+	to->reassoc += from->reassoc;
+	to->cse += from->cse;
+	to->constprop += from->constprop;
+	to->gvn += from->gvn;
+	to->peephole += from->peephole;
+	to->sink.stores += from->sink.stores;
+	to->sink.loads += from->sink.loads;
+	if(from->regalloc.peak > to->regalloc.peak) to->regalloc.peak = from->regalloc.peak;
+	to->regalloc.spilled += from->regalloc.spilled;
+	if(from->regalloc.slots > to->regalloc.slots) to->regalloc.slots = from->regalloc.slots;
+	to->sim.instrs += from->sim.instrs;
+	to->sim.cycles += from->sim.cycles;
+	to->sim.stalls += from->sim.stalls;
+	to->sim.faults += from->sim.faults;
+	to->schedule.moved += from->schedule.moved;
+	to->schedule.before += from->schedule.before;
+	to->schedule.after += from->schedule.after;
+	to->cache.hits += from->cache.hits;
+	to->cache.misses += from->cache.misses;
+	to->cache.evictions += from->cache.evictions;
+	Stats *st = &to->stats;
+	st->statements += from->stats.statements;
+	for(int i = 0; i < PHASES; i++)
+		st->ns[i] += from->stats.ns[i];
+	st->tokens += from->stats.tokens;
+	st->ast_nodes += from->stats.ast_nodes;
+	st->allocs += from->stats.allocs;
+	st->regs += from->stats.regs;
+	if(from->stats.max_reg > st->max_reg) st->max_reg = from->stats.max_reg;
+	for(int i = 0; i < 7; i++) {
+		st->generated[i] += from->stats.generated[i];
+		st->emitted[i] += from->stats.emitted[i];
+	}
+}
+#endif
+
+static long now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+static long stats_phase(Stats *st, int phase, long start) {
+	long t = now_ns();
+	st->ns[phase] += t - start;
+	return t;
+}
+
+static void stats_print(const Stats *st) {
+	fprintf(stderr, "\"ns\":{");
+	for(int i = 0; i < PHASES; i++)
+		fprintf(stderr, "%s\"%s\":%ld", i ? "," : "", PHASENAME[i], st->ns[i]);
+	fprintf(stderr, "},\"tokens\":%ld,\"ast_nodes\":%ld,\"allocations\":%ld,\"registers\":%ld,\"max_reg\":%ld",
+		st->tokens, st->ast_nodes, st->allocs, st->regs, st->max_reg);
+	fprintf(stderr, ",\"generated\":{");
+	for(int i = 0; i < 7; i++)
+		fprintf(stderr, "%s\"%s\":%ld", i ? "," : "", OPNAME[i], st->generated[i]);
+	fprintf(stderr, "},\"emitted\":{");
+	for(int i = 0; i < 7; i++)
+		fprintf(stderr, "%s\"%s\":%ld", i ? "," : "", OPNAME[i], st->emitted[i]);
+	fprintf(stderr, "}");
+}
+
+#ifndef COMPILER_NO_MAIN
+static void report_print(const Options *opt, const Report *rep) {
+	if(opt->simplify)
+		fprintf(stderr, "simplify: applied %ld identities\n", rep->simplify);
+	if(opt->reassoc)
+		fprintf(stderr, "reassoc: folded %ld constants\n", rep->reassoc);
+	if(opt->cse)
+		fprintf(stderr, "cse: merged %ld subtrees\n", rep->cse);
+	if(opt->constprop)
+		fprintf(stderr, "constprop: folded %ld instructions\n", rep->constprop);
+	if(opt->gvn)
+		fprintf(stderr, "gvn: reused %ld values\n", rep->gvn);
+	if(opt->sink)
+		fprintf(stderr, "sink: removed %ld stores and %ld loads\n", rep->sink.stores, rep->sink.loads);
+	if(opt->peephole)
+		fprintf(stderr, "peephole: removed %ld instructions\n", rep->peephole);
+	if(opt->regs)
+		fprintf(stderr, "regalloc: %d registers, peak pressure %d, %d values spilled to %d slots\n",
+			opt->regs, rep->regalloc.peak, rep->regalloc.spilled, rep->regalloc.slots);
+	if(opt->simulate)
+		fprintf(stderr, "simulate: %ld instructions, %ld cycles, %ld stall cycles, %ld faults\n",
+			rep->sim.instrs, rep->sim.cycles, rep->sim.stalls, rep->sim.faults);
+	if(opt->schedule)
+		fprintf(stderr, "schedule: moved %ld instructions, %ld stall cycles before and %ld after\n",
+			rep->schedule.moved, rep->schedule.before, rep->schedule.after);
+	if(opt->cache)
+		fprintf(stderr, "cache: %ld hits, %ld misses, %ld evictions\n",
+			rep->cache.hits, rep->cache.misses, rep->cache.evictions);
+	if(opt->stats) {
+		fprintf(stderr, "{\"statements\":%ld,", rep->stats.statements);
+		stats_print(&rep->stats);
+		fprintf(stderr, "}\n");
+	}
+}
+#endif
+
+static void compile_line(Compiler *c, const char *in, size_t n) {
+	// Variables loaded by an earlier statement are loaded again.
+	c->line++;
+	// Timing costs a clock read per phase, so it is off unless --stats asks for it.
+	Stats *st = &c->report.stats;
+	long t = 0, reg = c->reg, allocs = c->arena.allocs;
+	if(c->opt.stats) {
+		c->stats_mark = *st;
+		t = now_ns();
+	}
+	// build token array by lexer
+	int length;
+	Token *content = lexer(c, in, n, &length);
+	// blank line
+	if(length == 0)
+		return ;
+	st->statements++;
+	st->tokens += length;
+	if(c->opt.stats) t = stats_phase(st, PhaseLexer, t);
+	if(c->opt.cache) {
+		int from = c->ir.len;
+		CacheEntry *hit = cache_find(c, content, length);
+		if(hit != NULL)
+			cache_replay(c, hit);
+		if(c->opt.stats) t = stats_phase(st, PhaseCache, t);
+		if(hit == NULL) {
+			int simplified = c->report.simplify, reassociated = c->report.reassoc, merged = c->report.cse;
+			ScheduleReport sched = c->report.schedule;
+			t = translate(c, content, length, t);
+			sched.moved = c->report.schedule.moved - sched.moved;
+			sched.before = c->report.schedule.before - sched.before;
+			sched.after = c->report.schedule.after - sched.after;
+			cache_insert(c, content, length, reg, from,
+				c->report.simplify - simplified, c->report.reassoc - reassociated, c->report.cse - merged, &sched);
+			if(c->opt.stats) t = stats_phase(st, PhaseCache, t);
+		}
+	}
+	else
+		t = translate(c, content, length, t);
+	long top = c->reg;
+	st->regs += top - reg;
+	if(top > st->max_reg) st->max_reg = top;
+	st->allocs += c->arena.allocs - allocs;
+	c->reg=c->var_top+1;
+	arena_reset(&c->arena);
+	// Register allocation and store sinking need the whole program. Otherwise hold the last
+	// window back so peephole patterns can span statements.
+	if(!c->opt.regs && !c->opt.sink)
+		ir_flush(c, c->opt.peephole);
+	if(c->opt.stats == 2) {
+		// The counters of this statement alone.
+		Stats one = *st, *before = &c->stats_mark;
+		for(int i = 0; i < PHASES; i++)
+			one.ns[i] -= before->ns[i];
+		one.tokens -= before->tokens;
+		one.ast_nodes -= before->ast_nodes;
+		one.allocs -= before->allocs;
+		one.regs -= before->regs;
+		one.max_reg = top;
+		for(int i = 0; i < 7; i++) {
+			one.generated[i] -= before->generated[i];
+			one.emitted[i] -= before->emitted[i];
 		}
-		//printf("val=%d\n", val);
-		reg=val+1;
+		fprintf(stderr, "{\"statement\":%ld,", st->statements);
+		stats_print(&one);
+		fprintf(stderr, "}\n");
+	}
+}
+
+static long translate(Compiler *c, Token *arr, int n, long t) {
+	Stats *st = &c->report.stats;
+	// build abstract syntax tree by parser
+	Node ast_root = parser(c, arr, 0, n-1);
+#ifdef AST_DEBUG
+	AST_print(c, ast_root, 0);
+#endif
+	if(c->opt.stats) t = stats_phase(st, PhaseParser, t);
+	// check if the syntax is correct
+	semantic_check(c, ast_root);
+	if(c->opt.stats) t = stats_phase(st, PhaseSemantic, t);
+	if(c->opt.simplify) {
+		c->report.simplify += simplify(c, &ast_root);
+		if(c->opt.stats) t = stats_phase(st, PhaseSimplify, t);
+	}
+	if(c->opt.reassoc) {
+		c->report.reassoc += reassoc(c, &ast_root);
+		if(c->opt.stats) t = stats_phase(st, PhaseReassoc, t);
+	}
+	if(c->opt.cse) {
+		c->report.cse += cse(c, &ast_root);
+		if(c->opt.stats) t = stats_phase(st, PhaseCse, t);
+	}
+	turn_to_reg(c, &ast_root);
+	if(c->opt.stats) t = stats_phase(st, PhaseTurnToReg, t);
+	// generate the assembly
+	int from = c->ir.len;
+	c->first=ast_root;
+	codegen(c, ast_root);
+	if(c->opt.stats) t = stats_phase(st, PhaseCodegen, t);
+	if(c->opt.schedule) {
+		schedule(&c->machine.desc, c->ir.arr + from, c->ir.len - from, &c->arena, &c->report.schedule);
+		if(c->opt.stats) t = stats_phase(st, PhaseSchedule, t);
+	}
+	return t;
+}
+
+#ifndef COMPILER_NO_MAIN
+static int compile_text(Compiler *c, const char *data, size_t n) {
+	if(setjmp(c->fail)) {
+		print_error(c);
+		return 1;
+	}
+	const char *now = data, *end = data + n;
+	while(now < end) {
+		const char *eol = (const char*)memchr(now, '\n', end - now);
+		if(eol == NULL) eol = end;
+		compile_line(c, now, eol - now);
+		now = eol + 1;
 	}
 	return 0;
 }
 
-Token *lexer(char *in) {
-	Token *head = NULL, *tmp = NULL;
-	Token **now = &head, *prev = NULL;
-	int par_cnt = 0;
-	for(int i = 0; in[i]; i++) {
-		if(in[i] == ' ' || in[i] == '\n')
-			continue;
+static int compile_stream(Compiler *c, FILE *in) {
+	if(setjmp(c->fail)) {
+		print_error(c);
+		return 1;
+	}
+	ssize_t n;
+	while((n = getline(&c->input, &c->input_cap, in)) != -1)
+		compile_line(c, c->input, n);
+	return 0;
+}
+
+static int compile_file(Compiler *c, const char *path) {
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if(fd == -1 || fstat(fd, &st) == -1) {
+		perror(path);
+		if(fd != -1) close(fd);
+		return -1;
+	}
+	if(st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	const char *data = (const char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(data == MAP_FAILED) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	madvise((void*)data, st.st_size, MADV_SEQUENTIAL);
+	int res = compile_text(c, data, st.st_size);
+	munmap((void*)data, st.st_size);
+	close(fd);
+	return res;
+}
+#endif
+
+#ifndef COMPILER_NO_MAIN
+// Batch mode
+//
+// Every file is a job of its own, compiled by its own Compiler into "<file>.s". Each worker
+// owns a contiguous range of jobs and takes them from the front; a worker that runs out steals
+// from the back of another's range, so one long file doesn't leave the other threads idle.
+// What a job writes doesn't depend on the worker that ran it, and the counters are added up
+// in file order once every worker is done.
+
+typedef struct _BATCH Batch;
+typedef struct _WORKER {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int next, end; // jobs not taken yet
+	Batch *batch;
+} Worker;
+struct _BATCH {
+	const Options *opt;
+	char **path;
+	Report *report; // by job
+	int *failed; // by job
+	Worker *worker;
+	int nworkers;
+};
 
-		else if('x' <= in[i] && in[i] <= 'z')
-			(*now) = new_token(Variable, in[i]);
+// Take the next job of "w" from the front, or steal one from the back of "from". Return -1 if there is none.
+static int take_job(Worker *w, Worker *from) {
+	int job = -1;
+	pthread_mutex_lock(&from->lock);
+	if(from->next < from->end)
+		job = w == from ? from->next++ : --from->end;
+	pthread_mutex_unlock(&from->lock);
+	return job;
+}
+
+static int run_job(const Options *opt, const char *path, Report *rep) {
+	size_t len = strlen(path);
+	char *out = (char*)malloc(len + 3);
+	Compiler *c = (Compiler*)malloc(sizeof(Compiler));
+	if(out == NULL || c == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	memcpy(out, path, len);
+	memcpy(out + len, ".s", 3);
+	int fd = open(out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd == -1) {
+		perror(out);
+		free(out);
+		free(c);
+		return 1;
+	}
+	compiler_init(c, opt, fd);
+	int res = compile_file(c, path);
+	if(res == 0)
+		compiler_finish(c);
+	*rep = c->report;
+	compiler_free(c);
+	free(c);
+	free(out);
+	return close(fd) == -1 || res == -1;
+}
+
+static void *worker_main(void *arg) {
+	Worker *w = (Worker*)arg;
+	Batch *b = w->batch;
+	int id = w - b->worker;
+	for(;;) {
+		int job = take_job(w, w);
+		for(int k = 1; job == -1 && k < b->nworkers; k++)
+			job = take_job(w, &b->worker[(id + k) % b->nworkers]);
+		if(job == -1)
+			return NULL;
+		b->failed[job] = run_job(b->opt, b->path[job], &b->report[job]);
+	}
+}
 
-		else if(isdigit(in[i])) {
-			int val = 0, oi = i;
-			for(; isdigit(in[i]); i++)
-				val = val * 10 + (in[i] - '0');
-			i--;
-			// Detect illegal number inputs such as "01"
-			if(oi != i && in[oi] == '0')
-				err();
-			(*now) = new_token(Value, val);
+static int compile_batch(const Options *opt, char **path, int n, int jobs, Report *total) {
+	Batch b = {opt, path, NULL, NULL, NULL, jobs < n ? jobs : n};
+	if(b.nworkers < 1) b.nworkers = 1;
+	b.report = (Report*)calloc(n + 1, sizeof(Report));
+	b.failed = (int*)calloc(n + 1, sizeof(int));
+	b.worker = (Worker*)calloc(b.nworkers, sizeof(Worker));
+	if(b.report == NULL || b.failed == NULL || b.worker == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	for(int i = 0; i < b.nworkers; i++) {
+		Worker *w = &b.worker[i];
+		pthread_mutex_init(&w->lock, NULL);
+		w->next = (long)n * i / b.nworkers;
+		w->end = (long)n * (i + 1) / b.nworkers;
+		w->batch = &b;
+	}
+	// The calling thread is worker 0.
+	for(int i = 1; i < b.nworkers; i++)
+		if(pthread_create(&b.worker[i].thread, NULL, worker_main, &b.worker[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
 		}
+	worker_main(&b.worker[0]);
+	for(int i = 1; i < b.nworkers; i++)
+		pthread_join(b.worker[i].thread, NULL);
 
-		else {
-			switch(in[i]) {
-				case '+':
-					if(in[i+1] == '+') { // '++'
-						tmp = prev;
-						while(tmp != NULL && tmp->kind == RPar) tmp = tmp->prev;
-						if(tmp != NULL && tmp->kind == Variable)
-							(*now) = new_token(PostInc, -1);
-						else (*now) = new_token(PreInc, -1);
-						i++;
-					}
-					else { // '+'
-						if(prev == NULL || isOp(prev->kind) || prev->kind == LPar || isPlusMinus(prev->kind))
-							(*now) = new_token(Plus, -1);
-						else (*now) = new_token(Add, -1);
-					}
-					break;
-				case '-':
-					if(in[i+1] == '-') { // '--'
-						tmp = prev;
-						while(tmp != NULL && tmp->kind == RPar) tmp = tmp->prev;
-						if(tmp != NULL && tmp->kind == Variable)
-							(*now) = new_token(PostDec, -1);
-						else (*now) = new_token(PreDec, -1);
-						i++;
-					}
-					else { // '-'
-						if(prev == NULL || isOp(prev->kind) || prev->kind == LPar || isPlusMinus(prev->kind))
-							(*now) = new_token(Minus, -1);
-						else (*now) = new_token(Sub, -1);
-					}
-					break;
-				case '*':
-					(*now) = new_token(Mul, -1);
-					break;
-				case '/':
-					(*now) = new_token(Div, -1);
-					break;
-				case '%':
-					(*now) = new_token(Rem, -1);
-					break;
-				case '(':
-					(*now) = new_token(LPar, par_cnt++);
-					break;
-				case ')':
-					(*now) = new_token(RPar, --par_cnt);
-					break;
-				case '=':
-					(*now) = new_token(Assign, -1);
-					break;
-				default:
-					err();
-			}
-		}
-		(*now)->prev = prev;
-		if(prev != NULL) prev->next = (*now);
-		prev = (*now);
-		now = &((*now)->next);
-	}
-	return head;
-}
-
-AST *parser(Token *arr, int l, int r) {
-	if(l > r) return NULL;
-	// covered in parentheses
-	if(r == findParPair(arr, l, r)) {
-		AST *res = new_AST(arr+l);
-		res->mid = parser(arr, l+1, r-1);
-		return res;
-	}
-
-	int mid = find_Tmid(arr, l, r);
-	AST *newN = new_AST(arr + mid);
-	
-	if(l == r) {
-		if(newN->type <= Variable)
-        {
-            return newN;
-        }
-		else err();
-	}
-
-	if(getOpLevel(arr[mid].kind) == 1) // a++, a--
-		newN->mid = parser(arr, l, mid-1);
-	// TODO: Implement the remaining parser part.
-	// hint: else if(other op type?) then do something ..etc
-    else if(getOpLevel(arr[mid].kind)==2)
-    {
-        newN->mid=parser(arr, mid+1, r);
-    }
-    else if(getOpLevel(arr[mid].kind)==3)
-    {
-        newN->lhs=parser(arr, l, mid-1);
-        newN->rhs=parser(arr, mid+1, r);
-    }
-    else if(getOpLevel(arr[mid].kind)==4)
-    {
-        newN->lhs=parser(arr, l, mid-1);
-        newN->rhs=parser(arr, mid+1, r);
-    }
-    else if(getOpLevel(arr[mid].kind)==14)
-    {
-        newN->lhs=parser(arr, l, mid-1);
-        newN->rhs=parser(arr, mid+1, r);
-    }
+	int failed = 0;
+	memset(total, 0, sizeof(Report));
+	for(int i = 0; i < n; i++) {
+		report_add(total, &b.report[i]);
+		failed += b.failed[i];
+	}
+	for(int i = 0; i < b.nworkers; i++)
+		pthread_mutex_destroy(&b.worker[i].lock);
+	free(b.report);
+	free(b.failed);
+	free(b.worker);
+	return failed;
+}
+#endif
 
-	return newN;
+// Classes of the bytes a statement is made of. Any other byte is an error.
+enum {
+	CharBad, CharSpace, CharLetter, CharDigit,
+	CharPlus, CharMinus, CharMul, CharDiv, CharRem, CharOpen, CharClose, CharAssign
+};
+static const unsigned char CHAR_CLASS[256] = {
+	[' '] = CharSpace, ['\n'] = CharSpace,
+	['a' ... 'z'] = CharLetter, ['A' ... 'Z'] = CharLetter, ['_'] = CharLetter,
+	['0' ... '9'] = CharDigit,
+	['+'] = CharPlus, ['-'] = CharMinus, ['*'] = CharMul, ['/'] = CharDiv, ['%'] = CharRem,
+	['('] = CharOpen, [')'] = CharClose, ['='] = CharAssign
+};
+#define CHAR_OF(ch) (CHAR_CLASS[(unsigned char)(ch)])
+
+static size_t skip_space_scalar(const char *in, size_t i, size_t n) {
+	while(i < n && CHAR_OF(in[i]) == CharSpace)
+		i++;
+	return i;
+}
+
+static size_t skip_digit_scalar(const char *in, size_t i, size_t n) {
+	while(i < n && CHAR_OF(in[i]) == CharDigit)
+		i++;
+	return i;
+}
+
+#ifdef LEXER_SIMD
+// The vector kernels only load whole vectors inside the statement, since it may end right at
+// the end of a mapped file, and leave the tail to the scalar ones.
+__attribute__((target("sse2")))
+static size_t skip_space_sse2(const char *in, size_t i, size_t n) {
+	const __m128i blank = _mm_set1_epi8(' '), newline = _mm_set1_epi8('\n');
+	for(; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+		unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, blank), _mm_cmpeq_epi8(v, newline)));
+		if(mask != 0xFFFF)
+			return i + __builtin_ctz(~mask);
+	}
+	return skip_space_scalar(in, i, n);
+}
+
+__attribute__((target("sse2")))
+static size_t skip_digit_sse2(const char *in, size_t i, size_t n) {
+	const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9);
+	for(; i + 16 <= n; i += 16) {
+		// A byte is a digit when it is at most 9 above '0', as an unsigned number.
+		__m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(in + i)), zero);
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, nine), v));
+		if(mask != 0xFFFF)
+			return i + __builtin_ctz(~mask);
+	}
+	return skip_digit_scalar(in, i, n);
+}
+
+__attribute__((target("avx2")))
+static size_t skip_space_avx2(const char *in, size_t i, size_t n) {
+	const __m256i blank = _mm256_set1_epi8(' '), newline = _mm256_set1_epi8('\n');
+	for(; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+		unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, blank), _mm256_cmpeq_epi8(v, newline)));
+		if(mask != 0xFFFFFFFFu)
+			return i + __builtin_ctz(~mask);
+	}
+	return skip_space_sse2(in, i, n);
+}
+
+__attribute__((target("avx2")))
+static size_t skip_digit_avx2(const char *in, size_t i, size_t n) {
+	const __m256i zero = _mm256_set1_epi8('0'), nine = _mm256_set1_epi8(9);
+	for(; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(in + i)), zero);
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(v, nine), v));
+		if(mask != 0xFFFFFFFFu)
+			return i + __builtin_ctz(~mask);
+	}
+	return skip_digit_sse2(in, i, n);
+}
+
+// Value of the "k" digits at "p", 4 <= k <= 8, of which 8 bytes can be read. The digits are
+// lined up as the low bytes of one little endian word and then combined pairwise.
+static inline uint32_t parse_digits(const char *p, size_t k) {
+	uint64_t v;
+	memcpy(&v, p, 8);
+	// Bytes past the digits may borrow, but only from later bytes, which the shift drops.
+	v = (v - 0x3030303030303030ull) << (8 * (8 - k));
+	v = v * 10 + (v >> 8);
+	v = ((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32))
+		+ ((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32))) >> 32;
+	return (uint32_t)v;
+}
+#endif
+
+static void scanner_init(Scanner *s) {
+	s->skip_space = skip_space_scalar;
+	s->skip_digit = skip_digit_scalar;
+#ifdef LEXER_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		s->skip_space = skip_space_avx2;
+		s->skip_digit = skip_digit_avx2;
+	}
+	else if(__builtin_cpu_supports("sse2")) {
+		s->skip_space = skip_space_sse2;
+		s->skip_digit = skip_digit_sse2;
+	}
+#endif
+}
+
+// Value of the "len" digits at "p", of which "avail" bytes can be read. It wraps around like
+// adding one digit at a time would, so blocks of digits can be folded in at once.
+static int lex_value(const char *p, size_t len, size_t avail) {
+	uint32_t val = 0;
+#ifdef LEXER_SIMD
+	static const uint32_t pow10[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+	for(; len >= 8; p += 8, len -= 8, avail -= 8)
+		val = val * pow10[8] + parse_digits(p, 8);
+	if(len >= 4 && avail >= 8)
+		return (int)(val * pow10[len] + parse_digits(p, len));
+#endif
+	for(; len > 0; p++, len--)
+		val = val * 10 + (uint32_t)(*p - '0');
+	return (int)val;
 }
 
-void semantic_check(AST *now) {
-	if(isUnary(now->type) || isPar(now->type)) {
-		if(now->lhs != NULL || now->rhs != NULL)
-			err();
-		if(now->mid == NULL)
-			err();
-		if(isUnary(now->type)) {
-			AST *tmp = now->mid;
-			if(isPar(tmp->type)) {
-				while(isPar(tmp->type))
-					tmp = tmp->mid;
+static Token *lexer(Compiler *c, const char *in, size_t n, int *len) {
+	Token *prev = NULL;
+	// "open" is the innermost unmatched '(' and each '(' keeps the enclosing one in "pair" until it is closed.
+	int par_cnt = 0, open = -1, tmp;
+	c->tokens.len = 0;
+	for(size_t i = 0; i < n; i++) {
+		switch(CHAR_OF(in[i])) {
+			case CharSpace:
+				// Runs of blanks, such as indentation, are skipped by the kernel.
+				if(i + 1 < n && CHAR_OF(in[i+1]) == CharSpace)
+					i = c->scan.skip_space(in, i + 2, n) - 1;
+				continue;
+			case CharLetter: {
+				// An identifier goes on with letters and digits.
+				size_t end = i + 1;
+				while(end < n && (CHAR_OF(in[end]) == CharLetter || CHAR_OF(in[end]) == CharDigit))
+					end++;
+				new_token(c, Variable, sym_intern(c, in + i, end - i));
+				i = end - 1;
+				break;
 			}
-			if(isPlusMinus(now->type)) {
-				if(isUnary(tmp->type));
-				else if(isOperand(tmp->type));
-				else err();
+			case CharDigit: {
+				// Short literals end here, and the kernel finds the end of the long ones.
+				size_t end = i + 1;
+				while(end < n && end - i < 4 && CHAR_OF(in[end]) == CharDigit)
+					end++;
+				if(end - i == 4)
+					end = c->scan.skip_digit(in, end, n);
+				// Detect illegal number inputs such as "01"
+				if(end - i > 1 && in[i] == '0')
+					err(c);
+				new_token(c, Value, lex_value(in + i, end - i, n - i));
+				i = end - 1;
+				break;
 			}
-			else if(tmp->type != Variable)
-				err();
+			case CharPlus:
+				if(i + 1 < n && in[i+1] == '+') { // '++'
+					tmp = c->tokens.len - 1;
+					while(tmp >= 0 && c->tokens.arr[tmp].kind == RPar) tmp--;
+					if(tmp >= 0 && c->tokens.arr[tmp].kind == Variable)
+						new_token(c, PostInc, -1);
+					else new_token(c, PreInc, -1);
+					i++;
+				}
+				else { // '+'
+					if(prev == NULL || isOp(prev->kind) || prev->kind == LPar || isPlusMinus(prev->kind))
+						new_token(c, Plus, -1);
+					else new_token(c, Add, -1);
+				}
+				break;
+			case CharMinus:
+				if(i + 1 < n && in[i+1] == '-') { // '--'
+					tmp = c->tokens.len - 1;
+					while(tmp >= 0 && c->tokens.arr[tmp].kind == RPar) tmp--;
+					if(tmp >= 0 && c->tokens.arr[tmp].kind == Variable)
+						new_token(c, PostDec, -1);
+					else new_token(c, PreDec, -1);
+					i++;
+				}
+				else { // '-'
+					if(prev == NULL || isOp(prev->kind) || prev->kind == LPar || isPlusMinus(prev->kind))
+						new_token(c, Minus, -1);
+					else new_token(c, Sub, -1);
+				}
+				break;
+			case CharMul:
+				new_token(c, Mul, -1);
+				break;
+			case CharDiv:
+				new_token(c, Div, -1);
+				break;
+			case CharRem:
+				new_token(c, Rem, -1);
+				break;
+			case CharOpen:
+				new_token(c, LPar, par_cnt++)->pair = open;
+				open = c->tokens.len - 1;
+				break;
+			case CharClose:
+				if(open == -1)
+					err(c);
+				tmp = open;
+				open = c->tokens.arr[tmp].pair;
+				c->tokens.arr[tmp].pair = c->tokens.len;
+				new_token(c, RPar, --par_cnt)->pair = tmp;
+				break;
+			case CharAssign:
+				new_token(c, Assign, -1);
+				break;
+			default:
+				err(c);
 		}
+		prev = &c->tokens.arr[c->tokens.len - 1];
+	}
+	if(open != -1)
+		err(c);
+	*len = c->tokens.len;
+	return c->tokens.arr;
+}
 
-		semantic_check(now->mid);
+// Make room for more frames on "st".
+static void grow_frames(FrameStack *st) {
+	st->cap = st->cap ? st->cap * 2 : 64;
+	st->arr = (Frame*)realloc(st->arr, sizeof(Frame) * st->cap);
+	if(st->arr == NULL) {
+		perror("realloc");
+		exit(1);
 	}
-	// TODO: Implement the remaining semantic check part.
-	// hint: else if(other op type?) then do something ...etc
+}
 
-    else if(isOp(now->type))
-    {
-		if(now->lhs == NULL || now->rhs == NULL)
-			err();
-        if(now->mid!=NULL)
-            err();
-		if(now->type==Assign)
-		{
-			if((now->lhs)->type!=LPar&&(now->lhs)->type!=Variable)
-				err();
-			while((now->lhs)->type==LPar)
-			{
-				AST *del=now->lhs;
-				now->lhs=del->mid;
-				free(del);
+// Push a frame for "node" in "state" onto the walk stack of "c". The frame returned stays valid
+// until the next push.
+//
+// The tree walks are post-order and keep the ancestors of the node they are at on c->frames
+// rather than on the C stack. Going down to a child pushes the node with the child to look at
+// next in "state": 0 the left one, 1 the middle one, 2 the right one, 3 none. Going back up pops
+// the parent and goes on from its state.
+static inline Frame *new_frame(Compiler *c, Node node, int state) {
+	if(c->frames.len == c->frames.cap)
+		grow_frames(&c->frames);
+	Frame *res = &c->frames.arr[c->frames.len++];
+	res->node = node;
+	res->state = state;
+	return res;
+}
+
+// The grammar is the recursive descent of an expression, a chain of unary operands joined by
+// binary operators, and a unary operand, a prefix operator chain, then a Value, Variable, or
+// parenthesis pair, then postfix operators. The calls of the descent are frames on c->frames,
+// so a long prefix chain or deep parentheses need no C stack.
+static Node parser(Compiler *c, Token *arr, int l, int r) {
+	if(l > r) return 0;
+	// The nodes of the statement before are dropped.
+	c->ast.len = 1;
+	int pos = l;
+	int bound = r; // last token of the unary operand being parsed
+	c->frames.len = 0;
+	Frame *f = new_frame(c, 0, FrameExpr);
+	f->r = r;
+	f->level = getOpLevel(Assign);
+	for(;;) {
+		Node res;
+		// Descend into a unary operand.
+		for(;;) {
+			if(pos > bound)
+				err(c);
+			Node newN = new_AST(c, arr + pos);
+			if(getOpLevel(KIND(newN)) == 2) { // ++a, --a, +a, -a
+				pos++;
+				new_frame(c, newN, FramePrefix);
+				continue;
 			}
-			if((now->lhs)->type!=Variable)
-			{
-				err();
+			if(KIND(newN) == LPar) {
+				int close = arr[pos].pair;
+				pos++;
+				f = new_frame(c, newN, FramePar);
+				f->r = bound;
+				f->level = close;
+				f = new_frame(c, 0, FrameExpr);
+				f->r = close - 1;
+				f->level = getOpLevel(Assign);
+				bound = close - 1;
+				continue;
 			}
-			semantic_check(now->rhs);
+			else if(KIND(newN) == RPar || isOp(KIND(newN)) || getOpLevel(KIND(newN)) == 1)
+				err(c);
+			pos++;
+			res = parse_postfix(c, arr, &pos, bound, newN);
+			break;
 		}
-		else
-		{
-			semantic_check(now->lhs);
-        	semantic_check(now->rhs);
+		// Hand "res" back to the frames waiting for it until one wants another operand.
+		for(;;) {
+			f = &c->frames.arr[c->frames.len - 1];
+			if(f->state == FramePrefix) {
+				MID(f->node) = res;
+				res = f->node;
+				c->frames.len--;
+				continue;
+			}
+			if(f->state == FramePar) {
+				MID(f->node) = res;
+				if(pos != f->level)
+					err(c);
+				pos++;
+				bound = f->r;
+				res = parse_postfix(c, arr, &pos, bound, f->node);
+				c->frames.len--;
+				continue;
+			}
+			if(f->node != 0) {
+				RHS(f->node) = res;
+				res = f->node;
+				f->node = 0;
+			}
+			if(pos <= f->r && isBinaryOperator(arr[pos].kind) && getOpLevel(arr[pos].kind) <= f->level) {
+				Node newN = new_AST(c, arr + pos);
+				int op_level = getOpLevel(arr[pos++].kind);
+				LHS(newN) = res;
+				f->node = newN;
+				bound = f->r;
+				f = new_frame(c, 0, FrameExpr);
+				f->r = bound;
+				// Assign is right-associative, the others only take tighter operators on their right.
+				if(KIND(newN) == Assign)
+					f->level = op_level;
+				else
+					f->level = op_level - 1;
+				break;
+			}
+			if(--c->frames.len == 0) {
+				// Something is left that no operator could join, such as "x y".
+				if(pos <= r)
+					err(c);
+				return res;
+			}
 		}
-    }
-    else if(isOperand(now->type))
-    {
-        return ;
-    }
-    else if(now==NULL)
-        return ;
+	}
 }
 
-void turn_to_reg(AST** ast)
-{
-	if((*ast)->type==Assign)
-		turn_to_reg(&((*ast)->rhs));
-	else{
-		if((*ast)->lhs!=NULL)
-		{
-			//printf("in lhs\n");
-			turn_to_reg(&((*ast)->lhs));
-		}
-		if((*ast)->mid!=NULL)
-		{
-			//printf("in mid\n");
-			if(getOpLevel((*ast)->type)==1)
-			{
-				if(((*ast)->mid)->val=='x')
-					if(store[0].val!=-1)
-					{
-						if(store[1].val==store[0].val||store[2].val==store[0].val)
-							store[0].val=reg++;
-					}
-				else if(((*ast)->mid)->val=='y')
-					if(store[1].val!=-1)
-					{
-						if(store[0].val==store[1].val||store[2].val==store[1].val)
-							store[1].val=reg++;
-					}
-				else
-					if(store[2].val!=-1)
-					{
-						if(store[0].val==store[2].val||store[1].val==store[2].val)
-							store[2].val=reg++;
-					}
+static Node parse_postfix(Compiler *c, Token *arr, int *pos, int r, Node node) {
+	while(*pos <= r && getOpLevel(arr[*pos].kind) == 1) { // a++, a--
+		Node post = new_AST(c, arr + *pos);
+		MID(post) = node;
+		node = post;
+		(*pos)++;
+	}
+	return node;
+}
+
+static void semantic_check(Compiler *c, Node now) {
+	// The nodes waiting to be checked, so deep trees need no C stack. Operands pass anyway, so
+	// only the root may be one.
+	c->frames.len = 0;
+	new_frame(c, now, 0);
+	while(c->frames.len > 0) {
+		now = c->frames.arr[--c->frames.len].node;
+		if(isUnary(KIND(now)) || isPar(KIND(now))) {
+			if(LHS(now) != 0 || RHS(now) != 0)
+				err(c);
+			if(MID(now) == 0)
+				err(c);
+			if(isUnary(KIND(now))) {
+				Node tmp = MID(now);
+				if(isPar(KIND(tmp))) {
+					while(isPar(KIND(tmp)))
+						tmp = MID(tmp);
+				}
+				if(isPlusMinus(KIND(now))) {
+					if(isUnary(KIND(tmp)));
+					else if(isOperand(KIND(tmp)));
+					else err(c);
+				}
+				else if(KIND(tmp) != Variable)
+					err(c);
 			}
-			turn_to_reg(&((*ast)->mid));
-		}
-		if((*ast)->rhs!=NULL)
-		{
-			turn_to_reg(&((*ast)->rhs));
+
+			if(!isOperand(KIND(MID(now))))
+				new_frame(c, MID(now), 0);
 		}
-		if((*ast)->type==Variable)
-		{
-			if((*ast)->val=='x')
+		// TODO: Implement the remaining semantic check part.
+		// hint: else if(other op type?) then do something ...etc
+
+	    else if(isOp(KIND(now)))
+	    {
+			if(LHS(now) == 0 || RHS(now) == 0)
+				err(c);
+	        if(MID(now)!=0)
+	            err(c);
+			if(KIND(now)==Assign)
 			{
-				if(store[0].val==-1)
-					store[0].val=reg++;
-				if(store[0].type==0)
+				if(KIND(LHS(now))!=LPar&&KIND(LHS(now))!=Variable)
+					err(c);
+				while(KIND(LHS(now))==LPar)
 				{
-					printf("load r%d [0]\n", store[0].val);
-					++store[0].type;
+					Node del=LHS(now);
+					LHS(now)=MID(del);
 				}
-				(*ast)->val=store[0].val;
-			}
-			else if((*ast)->val=='y')
-			{
-				if(store[1].val==-1)
-					store[1].val=reg++;
-				if(store[1].type==0)
+				if(KIND(LHS(now))!=Variable)
 				{
-					printf("load r%d [4]\n", store[1].val);
-					++store[1].type;
+					err(c);
 				}
-				(*ast)->val=store[1].val;
+				if(!isOperand(KIND(RHS(now))))
+					new_frame(c, RHS(now), 0);
 			}
 			else
 			{
-				if(store[2].val==-1)
-					store[2].val=reg++;
-				if(store[2].type==0)
-				{
-					printf("load r%d [8]\n", store[2].val);
-					++store[2].type;
-				}
-				(*ast)->val=store[2].val;
+				// The left side goes on top, to be checked first.
+				if(!isOperand(KIND(RHS(now))))
+					new_frame(c, RHS(now), 0);
+				if(!isOperand(KIND(LHS(now))))
+					new_frame(c, LHS(now), 0);
 			}
-		}
+	    }
+	    else if(isOperand(KIND(now)))
+	    {
+	        continue ;
+	    }
+	    else if(now==0)
+	        continue ;
 	}
-	return ;
 }
 
-void codegen(AST *ast)
-{
+// Child "i" of "n": 0 the left one, 1 the middle one, 2 the right one.
+static Node *child_slot(Compiler *c, Node n, int i) {
+	return i == 0 ? &LHS(n) : i == 1 ? &MID(n) : &RHS(n);
+}
 
-	if (ast->type==PreInc||ast->type==PreDec)
-	{
-		if(ast->type==PreInc)
-			printf("add r%d r%d 1\n", (ast->mid)->val, (ast->mid)->val);
-		else if(ast->type==PreDec)
-			printf("sub r%d r%d 1\n", (ast->mid)->val, (ast->mid)->val);
-		else;
-		if(ast==first)
-		{
-			printf("store ");
-			if((ast->mid)->val==store[0].val)
-				printf("[0] ");
-			else if((ast->mid)->val==store[1].val)
-				printf("[1] ");
-			else
-				printf("[2] ");
-			printf("r%d\n", (ast->mid)->val);
+// Mark in c->pure the nodes of the tree at "ast" whose evaluation changes no variable. The
+// rewrites only drop or merge such nodes, so the marks stay right while they run.
+static void mark_pure(Compiler *c, Node ast) {
+	c->npure = c->ast.len;
+	c->pure = (uint8_t*)arena_alloc(&c->arena, c->npure);
+	c->pure[0] = 1;
+	// Post-order walk, see new_frame.
+	c->frames.len = 0;
+	Node now = ast;
+	int state = 0;
+	for(;;) {
+		if(state < 3) {
+			Node next = *child_slot(c, now, state++);
+			if(next != 0) {
+				new_frame(c, now, state);
+				now = next;
+				state = 0;
+			}
+			continue;
 		}
-		ast->type=(ast->mid)->type;
-		ast->val=(ast->mid)->val;
-		free(ast->mid);
-		ast->mid=NULL;
-		return ;
+		int kind = KIND(now);
+		c->pure[now] = !(kind == Assign || getOpLevel(kind) == 1 || kind == PreInc || kind == PreDec) &&
+			c->pure[LHS(now)] && c->pure[MID(now)] && c->pure[RHS(now)];
+		if(c->frames.len == 0) break;
+		Frame *f = &c->frames.arr[--c->frames.len];
+		now = f->node;
+		state = f->state;
 	}
-	else if(ast->type==LPar)
-	{
-		if(isUnary((ast->mid)->type))
-		{
-			AST *tmp=ast->mid;
-			ast->type=(ast->mid)->type;
-			ast->val=(ast->mid)->val;
-			ast->mid=tmp->mid;
-			free(tmp);
+}
+
+// Whether evaluating "now" changes no variable, once mark_pure went through its tree. Nodes
+// made after that are only built from such nodes.
+static int is_pure(Compiler *c, Node now) {
+	return now >= c->npure || c->pure[now];
+}
+
+// "now" without the parentheses around it.
+static Node strip_par(Compiler *c, Node now) {
+	while(KIND(now) == LPar)
+		now = MID(now);
+	return now;
+}
+
+// Whether the trees at "a" and "b" are equal but for parentheses. The pairs still to compare
+// go on c->frames above the walk that asks, "a" in "node" and "b" in "state".
+static int same_tree(Compiler *c, Node a, Node b) {
+	int base = c->frames.len, same = 1;
+	new_frame(c, a, b);
+	while(same && c->frames.len > base) {
+		Frame *f = &c->frames.arr[--c->frames.len];
+		a = f->node;
+		b = f->state;
+		if(a == 0 || b == 0) {
+			same = a == b;
+			continue;
 		}
-		if(isBinaryOperator((ast->mid)->type))
-		{
-			AST *tmp=ast->mid;
-			ast->type=(ast->mid)->type;
-			ast->val=(ast->mid)->val;
-			ast->lhs=tmp->lhs;
-			ast->rhs=tmp->rhs;
-			free(tmp);
-			ast->mid=NULL;
-		}
-		codegen(ast);
-		return ;
+		a = strip_par(c, a);
+		b = strip_par(c, b);
+		if(KIND(a) != KIND(b) || (isOperand(KIND(a)) && VAL(a) != VAL(b))) {
+			same = 0;
+			continue;
+		}
+		for(int k = 2; k >= 0; k--)
+			new_frame(c, *child_slot(c, a, k), *child_slot(c, b, k));
 	}
-	else if(isPlusMinus(ast->type))
-	{
-		int i=0;
-		if(ast->type==Minus)
-			++i;
-		while((ast->mid)->type!=Variable&&(ast->mid)->type!=Value)
-		{
-			if((ast->mid)->type==LPar)
-			{
-				AST *ignore=ast->mid;
-				ast->mid=ignore->mid;
-				free(ignore);
+	c->frames.len = base;
+	return same;
+}
+
+static int is_value(Compiler *c, Node now, int val) {
+	now = strip_par(c, now);
+	return KIND(now) == Value && VAL(now) == val;
+}
+
+// Turn "now" into the constant "val".
+static void make_value(Compiler *c, Node now, int val) {
+	KIND(now) = Value;
+	VAL(now) = val;
+	LHS(now) = MID(now) = RHS(now) = 0;
+}
+
+// Whether the node whose parent has the frame "top" on c->frames is, but for parentheses, the
+// value an assignment stores. The frame of a node lies right above the one of its parent.
+static int is_stored(Compiler *c, int top) {
+	for(int i = top; i >= 0; i--) {
+		Frame *f = &c->frames.arr[i];
+		if(KIND(f->node) != LPar)
+			return KIND(f->node) == Assign && f->state == 3;
+	}
+	return 0;
+}
+
+// Replace the operator at "*ast" by its pure operand "e". A variable is read by the operator that
+// uses it, so unwrapping "x+0" moves the read of x past the rest of the statement. That is only
+// done when nothing in the statement ("pure") has side effects. Callers also clear "pure" for the
+// value an assignment stores: codegen gives "y = z" the register of z, and a later ++, -- or "="
+// on one of them would change the other as well.
+static int replace_by(Compiler *c, Node *ast, Node e, int pure) {
+	if(!is_pure(c, e) || (!pure && KIND(strip_par(c, e)) == Variable))
+		return 0;
+	*ast = e;
+	return 1;
+}
+
+// Apply the identities to the node at "*ast", whose children are done, and return the number
+// applied. A node that turns into another one is replaced in "*ast".
+static int simplify_node(Compiler *c, Node *ast, int pure) {
+	Node now = *ast, lhs = LHS(now), rhs = RHS(now);
+	int n = 0;
+	switch(KIND(now)) {
+		case LPar: // (x), (3), ((e))
+			// Rewriting "((e)*1)" leaves "((e))".
+			if(KIND(MID(now)) == LPar) {
+				MID(now) = strip_par(c, MID(now));
+				n++;
 			}
-			if((ast->mid)->type!=Variable&&(ast->mid)->type!=Value)
-			{
-				AST *del=ast->mid;
-				if(del->type==Minus)
-					++i;
-				ast->mid=del->mid;
-				free(del);
+			if(isOperand(KIND(MID(now)))) {
+				*ast = MID(now);
+				return n + 1;
 			}
+			return n;
+		case Plus: // +e
+			return replace_by(c, ast, MID(now), pure);
+		case Minus: { // - -e
+			Node inner = strip_par(c, MID(now));
+			return KIND(inner) == Minus && replace_by(c, ast, MID(inner), pure);
 		}
-		
-		if(i%2==0)
-		{
-			ast->type=(ast->mid)->type;
-			ast->val=(ast->mid)->val;
-		}
-		else
-		{
-			ast->type=Minus;
-			if((ast->mid)->type==Value)
-			{
-				ast->type=Value;
-				ast->val=-(ast->mid)->val;
+		case Mul:
+			if(is_value(c, rhs, 1) && replace_by(c, ast, lhs, pure)) return 1; // e*1
+			if(is_value(c, lhs, 1) && replace_by(c, ast, rhs, pure)) return 1; // 1*e
+			if((is_value(c, lhs, 0) || is_value(c, rhs, 0)) && is_pure(c, lhs) && is_pure(c, rhs)) { // e*0
+				make_value(c, now, 0);
+				return 1;
 			}
-			else
-			{
-				if(ast->val==-1)
-					ast->val=reg++;
-				printf("sub r%d 0 r%d\n", ast->val, (ast->mid)->val);
-				ast->type=Variable;
-			}	
-		}
-		free(ast->mid);
-		ast->mid=NULL;
-		return ;	
+			return 0;
+		case Add:
+			if(is_value(c, rhs, 0) && replace_by(c, ast, lhs, pure)) return 1; // e+0
+			if(is_value(c, lhs, 0) && replace_by(c, ast, rhs, pure)) return 1; // 0+e
+			return 0;
+		case Sub:
+			if(is_value(c, rhs, 0) && replace_by(c, ast, lhs, pure)) return 1; // e-0
+			if(is_pure(c, lhs) && same_tree(c, lhs, rhs)) { // e-e
+				make_value(c, now, 0);
+				return 1;
+			}
+			return 0;
+		case Div:
+			if(is_value(c, rhs, 1) && replace_by(c, ast, lhs, pure)) return 1; // e/1
+			return 0;
+		case Rem:
+			if(is_value(c, rhs, 1) && is_pure(c, lhs)) { // e%1
+				make_value(c, now, 0);
+				return 1;
+			}
+			return 0;
 	}
-	else if(isBinaryOperator(ast->type)&&ast->type!=Assign)
-	{
-		if((ast->lhs)->type==Value&&(ast->rhs)->type==Value)
-		{
-			switch(ast->type)
-			{
-				case(Add):
-					ast->val=(ast->lhs)->val+(ast->rhs)->val;
-					break;
-				case(Sub):
-					ast->val=(ast->lhs)->val-(ast->rhs)->val;
-					break;
-				case(Mul):
-					ast->val=(ast->lhs)->val*(ast->rhs)->val;
-					break;
-				case(Div):
-					ast->val=(ast->lhs)->val/(ast->rhs)->val;
-					break;
-				case(Rem):
-					ast->val=(ast->lhs)->val%(ast->rhs)->val;
-					break;
+	return 0;
+}
+
+static int simplify(Compiler *c, Node *ast) {
+	mark_pure(c, *ast);
+	int pure = is_pure(c, KIND(*ast) == Assign ? RHS(*ast) : *ast), n = 0;
+	// Post-order walk, see new_frame. The node that takes the place of "now" goes into the slot
+	// of its parent.
+	c->frames.len = 0;
+	Node now = *ast;
+	int state = 0;
+	for(;;) {
+		// The operand of ++ and -- must stay a variable, and the left side of "=" too.
+		if(getOpLevel(KIND(now)) == 1 || KIND(now) == PreInc || KIND(now) == PreDec)
+			state = 3;
+		else if(KIND(now) == Assign && state < 2)
+			state = 2;
+		if(state < 3) {
+			Node next = *child_slot(c, now, state++);
+			if(next != 0 && !isOperand(KIND(next))) {
+				new_frame(c, now, state);
+				now = next;
+				state = 0;
 			}
-			ast->type=Value;
+			continue;
+		}
+		// Parentheses don't use "pure", and each run of them is walked by the node below only.
+		Node res = now;
+		n += simplify_node(c, &res, pure && (KIND(now) == LPar || !is_stored(c, c->frames.len - 1)));
+		if(c->frames.len == 0) {
+			*ast = res;
+			break;
+		}
+		Frame *f = &c->frames.arr[--c->frames.len];
+		now = f->node;
+		state = f->state;
+		*child_slot(c, now, state - 1) = res;
+	}
+	return n;
+}
+
+// Reassociation
+//
+// "x+1+2+y+3" parses as a left-leaning tree in which every Add has a non-constant child, so
+// codegen can't fold anything. The chain is flattened into signed terms, the constants are
+// summed with the machine's wraparound, and the chain is rebuilt as "x+y+6". Only chains whose
+// terms are all free of side effects are regrouped, so the order of ++ and -- is kept, and
+// Div and Rem end a chain since they don't associate.
+
+static int is_chain(Compiler *c, Node now, int mul) {
+	now = strip_par(c, now);
+	return mul ? KIND(now) == Mul : (KIND(now) == Add || KIND(now) == Sub);
+}
+
+// Number of terms of the chain "now". The nodes still to look at go on c->frames above the
+// walk that asks.
+static int count_terms(Compiler *c, Node now, int mul) {
+	int base = c->frames.len, n = 0;
+	new_frame(c, now, 0);
+	while(c->frames.len > base) {
+		now = c->frames.arr[--c->frames.len].node;
+		if(!is_chain(c, now, mul)) {
+			n++;
+			continue;
+		}
+		now = strip_par(c, now);
+		new_frame(c, RHS(now), 0);
+		new_frame(c, LHS(now), 0);
+	}
+	return n;
+}
+
+// The child of a chain node that a link of collect_terms stands for: the rhs of node link/2 when
+// "link" is odd, else its lhs. Links stay right when the pool moves, unlike pointers into it.
+static Node *term_slot(Compiler *c, int link) {
+	return link & 1 ? &RHS(link >> 1) : &LHS(link >> 1);
+}
+
+// Store the terms of the chain "now" in order in the frames from index "at" on: the link each
+// one hangs from in "node", and whether it is subtracted in "state". The children still to look
+// at go on c->frames above them the same way, the right one first.
+static void collect_terms(Compiler *c, Node now, int mul, int at) {
+	int base = c->frames.len;
+	now = strip_par(c, now);
+	new_frame(c, now * 2 + 1, KIND(now) == Sub);
+	new_frame(c, now * 2, 0);
+	while(c->frames.len > base) {
+		Frame f = c->frames.arr[--c->frames.len];
+		Node child = *term_slot(c, f.node);
+		if(is_chain(c, child, mul)) {
+			child = strip_par(c, child);
+			new_frame(c, child * 2 + 1, f.state ^ (KIND(child) == Sub));
+			new_frame(c, child * 2, f.state);
+			continue;
+		}
+		c->frames.arr[at].node = f.node;
+		c->frames.arr[at++].state = f.state;
+	}
+}
+
+// Whether "now" is a constant such as 3, -3 or (-(3)), whose value is stored in "val".
+static int const_term(Compiler *c, Node now, int *val) {
+	int neg = 0;
+	for(now = strip_par(c, now); KIND(now) == Plus || KIND(now) == Minus; now = strip_par(c, MID(now)))
+		neg ^= KIND(now) == Minus;
+	if(KIND(now) != Value)
+		return 0;
+	*val = neg ? (int)(0u - (unsigned)VAL(now)) : VAL(now);
+	return 1;
+}
+
+static Node new_node(Compiler *c, int type, int val, Node lhs, Node rhs) {
+	Token t = {type, val, 0};
+	Node now = new_AST(c, &t);
+	LHS(now) = lhs;
+	RHS(now) = rhs;
+	return now;
+}
+
+// Regroup the chain "now", whose "n" terms are regrouped already and listed in "term" as
+// collect_terms left them, and return the node that takes its place. The constants folded away
+// are added to "folded". "pure" tells whether the chain may turn into a bare variable, see
+// replace_by.
+static Node reassoc_chain(Compiler *c, Node now, const Frame *term, int n, int pure, int *folded) {
+	int mul = KIND(now) == Mul;
+	int consts = 0, all_pure = 1;
+	unsigned sum = mul ? 1 : 0;
+	for(int i = 0; i < n; i++) {
+		int v;
+		Node t = *term_slot(c, term[i].node);
+		all_pure &= is_pure(c, t);
+		if(const_term(c, t, &v)) {
+			consts++;
+			if(mul) sum *= (unsigned)v;
+			else sum += term[i].state ? 0u - (unsigned)v : (unsigned)v;
+		}
+	}
+	int identity = sum == (mul ? 1u : 0u);
+	if(!all_pure || consts == 0 || (consts == 1 && !identity && !(mul && sum == 0)))
+		return now;
+
+	// The terms keep their order, which is the order turn_to_reg loads the variables in. A chain
+	// that starts by subtracting starts from the constant instead: "3-x+y-4" becomes "-1-x+y".
+	Node res = 0;
+	int kept = !identity; // whether the constant appears in the result
+	if(mul && sum == 0)
+		res = new_node(c, Value, 0, 0, 0);
+	else {
+		int placed = 0;
+		for(int i = 0; i < n; i++) {
+			int v;
+			Node t = *term_slot(c, term[i].node);
+			if(const_term(c, t, &v)) continue;
+			if(res == 0 && !term[i].state) {
+				res = t;
+				continue;
+			}
+			if(res == 0) {
+				res = new_node(c, Value, (int)sum, 0, 0);
+				placed = kept = 1;
+			}
+			res = new_node(c, mul ? Mul : term[i].state ? Sub : Add, -1, res, t);
+		}
+		if(res == 0)
+			res = new_node(c, Value, (int)sum, 0, 0), kept = 1;
+		else if(!placed && !identity) {
+			if(!mul && (int)sum < 0 && (int)sum != INT_MIN)
+				res = new_node(c, Sub, -1, res, new_node(c, Value, -(int)sum, 0, 0));
+			else
+				res = new_node(c, mul ? Mul : Add, -1, res, new_node(c, Value, (int)sum, 0, 0));
+		}
+	}
+	if(!pure && KIND(strip_par(c, res)) == Variable)
+		return now;
+	*folded += consts - kept;
+	return res;
+}
+
+// Push the frame of "now" for reassoc, after the terms of a chain.
+static void reassoc_enter(Compiler *c, Node now) {
+	int mul = KIND(now) == Mul;
+	if(!mul && KIND(now) != Add && KIND(now) != Sub) {
+		new_frame(c, now, 0);
+		return;
+	}
+	int n = count_terms(c, now, mul), at = c->frames.len;
+	for(int i = 0; i < n; i++)
+		new_frame(c, 0, 0);
+	collect_terms(c, now, mul, at);
+	new_frame(c, now, 0)->r = n;
+}
+
+static int reassoc(Compiler *c, Node *ast) {
+	mark_pure(c, *ast);
+	int pure = is_pure(c, KIND(*ast) == Assign ? RHS(*ast) : *ast), folded = 0;
+	// Post-order walk, see new_frame. The frame of a chain node has the "r" terms of the chain
+	// below it, and "state" is the next one to regroup; the nodes in between are regrouped with
+	// the chain, not on their own. The node that takes the place of a regrouped one goes into
+	// its slot below.
+	c->frames.len = 0;
+	reassoc_enter(c, *ast);
+	for(;;) {
+		Frame *f = &c->frames.arr[c->frames.len - 1];
+		Node now = f->node, res = now;
+		int kind = KIND(now);
+		if(kind == Mul || kind == Add || kind == Sub) {
+			int n = f->r;
+			if(f->state < n) {
+				Node term = *term_slot(c, f[f->state++ - n].node);
+				if(!isOperand(KIND(term))) reassoc_enter(c, term);
+				continue;
+			}
+			res = reassoc_chain(c, now, f - n, n, pure && !is_stored(c, c->frames.len - n - 2), &folded);
+			c->frames.len -= n + 1;
+		}
+		else {
+			if(getOpLevel(kind) == 1 || kind == PreInc || kind == PreDec)
+				f->state = 3;
+			else if(kind == Assign && f->state < 2)
+				f->state = 2;
+			if(f->state < 3) {
+				Node next = *child_slot(c, now, f->state++);
+				if(next != 0 && !isOperand(KIND(next))) reassoc_enter(c, next);
+				continue;
+			}
+			c->frames.len--;
+			// A chain that folded to an operand or to one parenthesized term leaves "(3)" or
+			// "((e))" behind.
+			if(kind == LPar) {
+				MID(now) = strip_par(c, MID(now));
+				if(isOperand(KIND(MID(now)))) res = MID(now);
+			}
+		}
+		if(c->frames.len == 0) {
+			*ast = res;
+			break;
+		}
+		f = &c->frames.arr[c->frames.len - 1];
+		kind = KIND(f->node);
+		if(kind == Mul || kind == Add || kind == Sub)
+			*term_slot(c, f[f->state - 1 - f->r].node) = res;
+		else
+			*child_slot(c, f->node, f->state - 1) = res;
+	}
+	return folded;
+}
+
+// Common subexpressions
+//
+// Generated code repeats subexpressions such as y*z within one statement. Every Add, Sub, Mul,
+// Div and Rem whose operands are values, variables or such nodes again is looked up in a hash
+// table by its operator and operands, and equal ones become one node that several parents
+// read, so the AST turns into a DAG. turn_to_reg and codegen go through a shared node once, and
+// its register is not reused by its parents. Parentheses around these operators only group,
+// so they are dropped where they wrap a shared node. Nodes reading a variable that the
+// statement changes with ++, -- or an inner assignment, or one that shares its register, are
+// left alone. So is the value an assignment stores, since codegen computes it right into the
+// variable's register.
+
+// Marks of the nodes in c->shared.
+enum {
+	ShareMany = 1, // several parents read the node
+	ShareTurned = 2, // turn_to_reg went through the node
+	ShareGenerated = 4, // codegen went through the node
+	ShareKeep = 8, // the node stays on its own
+	SharePure = 16, // the node is in the table
+	ShareCounted = 32 // the node's parents are being counted
+};
+
+// Whether "n" is shared and already has "mark", which it gets otherwise.
+static int share_seen(Compiler *c, Node n, int mark) {
+	if(c->shared == NULL || !(c->shared[n] & ShareMany)) return 0;
+	if(c->shared[n] & mark) return 1;
+	c->shared[n] |= mark;
+	return 0;
+}
+
+static int share_many(Compiler *c, Node n) {
+	return c->shared != NULL && (c->shared[n] & ShareMany);
+}
+
+// Whether the operands "a" and "b" of two nodes of the table are equal.
+static int same_operand(Compiler *c, Node a, Node b) {
+	return a == b || (isOperand(KIND(a)) && KIND(a) == KIND(b) && VAL(a) == VAL(b));
+}
+
+// "n" without the parentheses that only group an operator of the table.
+static Node grouped(Compiler *c, Node n) {
+	while(n != 0 && KIND(n) == LPar && getOpLevel(KIND(MID(n))) >= 3 && KIND(MID(n)) != Assign)
+		n = MID(n);
+	return n;
+}
+
+static int int_cmp(const void *a, const void *b) {
+	int x = *(const int*)a, y = *(const int*)b;
+	return x < y ? -1 : x > y;
+}
+
+// Whether the variable "v" is written by the statement: it is one of the "n" sorted variables
+// of "var", or its register is one of theirs.
+static int var_written(Compiler *c, int v, const int *var, const int *reg, int n) {
+	int r = c->store[v].val;
+	return bsearch(&v, var, n, sizeof(int), int_cmp) != NULL ||
+		(r != -1 && bsearch(&r, reg, n, sizeof(int), int_cmp) != NULL);
+}
+
+static unsigned operand_hash(Compiler *c, Node a) {
+	return isOperand(KIND(a)) ? (unsigned)VAL(a) * 2 + KIND(a) : (unsigned)a * 0x9E3779B9u;
+}
+
+static int cse(Compiler *c, Node *ast) {
+	int n = c->ast.len, merged = 0;
+	c->shared = (uint8_t*)arena_alloc(&c->arena, n);
+	memset(c->shared, 0, n);
+	// Variables written before the statement ends and their registers, sorted, since the
+	// variables sharing a register change with them. The pool may hold nodes the rewriting
+	// passes dropped, which only leaves more alone.
+	int *written = (int*)arena_alloc(&c->arena, sizeof(int) * 2 * n), *written_reg = written + n, nw = 0;
+	for(Node i = 1; i < n; i++) {
+		Node var = 0;
+		if(getOpLevel(KIND(i)) == 1 || KIND(i) == PreInc || KIND(i) == PreDec)
+			var = strip_par(c, MID(i));
+		else if(KIND(i) == Assign) {
+			c->shared[strip_par(c, RHS(i))] |= ShareKeep;
+			if(i != *ast) var = strip_par(c, LHS(i));
+		}
+		if(var != 0 && KIND(var) == Variable) {
+			written[nw] = VAL(var);
+			written_reg[nw++] = c->store[VAL(var)].val;
+		}
+	}
+	qsort(written, nw, sizeof(int), int_cmp);
+	qsort(written_reg, nw, sizeof(int), int_cmp);
+	unsigned mask = 15;
+	while(mask < 2u * n) mask = mask * 2 + 1;
+	Node *table = (Node*)arena_alloc(&c->arena, sizeof(Node) * (mask + 1));
+	memset(table, 0, sizeof(Node) * (mask + 1));
+	// Post-order walk, see new_frame.
+	c->frames.len = 0;
+	Node now = *ast;
+	int state = 0;
+	for(;;) {
+		if(state < 3) {
+			Node next = *child_slot(c, now, state++);
+			if(next != 0 && !isOperand(KIND(next))) {
+				new_frame(c, now, state);
+				now = next;
+				state = 0;
+			}
+			continue;
+		}
+		// The node that stands for "now" in its parent, which only changes for a merged one.
+		Node res = grouped(c, now), lhs = grouped(c, LHS(now)), rhs = grouped(c, RHS(now));
+		int op = getOpLevel(KIND(now));
+		if((op == 3 || op == 4) && !(c->shared[now] & ShareKeep)) {
+			int pure = 1;
+			for(int k = 0; k < 2; k++) {
+				Node o = k ? rhs : lhs;
+				if(KIND(o) == Variable) pure &= !var_written(c, VAL(o), written, written_reg, nw);
+				else if(KIND(o) != Value) pure &= (c->shared[o] & SharePure) != 0;
+			}
+			if(pure) {
+				c->shared[now] |= SharePure;
+				unsigned h = (KIND(now) * 31u + operand_hash(c, lhs)) * 0x9E3779B9u + operand_hash(c, rhs);
+				for(h &= mask; table[h] != 0; h = (h + 1) & mask) {
+					Node e = table[h];
+					if(KIND(e) == KIND(now) && same_operand(c, grouped(c, LHS(e)), lhs)
+						&& same_operand(c, grouped(c, RHS(e)), rhs)) {
+						res = e;
+						merged++;
+						break;
+					}
+				}
+				if(res == now) table[h] = now;
+			}
+		}
+		if(c->frames.len == 0) break;
+		Frame *f = &c->frames.arr[--c->frames.len];
+		now = f->node;
+		state = f->state;
+		Node *slot = child_slot(c, now, state - 1);
+		if(grouped(c, *slot) != res) *slot = res;
+	}
+	// Mark the nodes that several parents of the DAG now read.
+	c->frames.len = 0;
+	new_frame(c, *ast, 0);
+	while(c->frames.len > 0) {
+		now = c->frames.arr[--c->frames.len].node;
+		for(int k = 0; k < 3; k++) {
+			Node ch = *child_slot(c, now, k);
+			if(ch == 0 || isOperand(KIND(ch))) continue;
+			if(c->shared[ch] & ShareCounted)
+				c->shared[ch] |= ShareMany;
+			else {
+				c->shared[ch] |= ShareCounted;
+				new_frame(c, ch, 0);
+			}
+		}
+	}
+	// Codegen turns parentheses into a copy of the node they wrap, so drop those around a
+	// shared node.
+	for(Node i = 1; i < n; i++) {
+		if(i != *ast && !(c->shared[i] & ShareCounted)) continue;
+		for(int k = 0; k < 3; k++) {
+			Node *slot = child_slot(c, i, k), g = grouped(c, *slot);
+			if(g != *slot && (c->shared[g] & ShareMany)) *slot = g;
+		}
+	}
+	return merged;
+}
+
+static void turn_to_reg_var(Compiler *c, Node now)
+{
+	int v=VAL(now);
+	VarReg *var=&c->store[v];
+	if(var->val==-1)
+		var_set_reg(c, v, c->reg++);
+	if(var->loaded!=c->line)
+	{
+		ir_append(c, OpLoad, opd_reg(var->val), opd_mem(VAR_SLOT(v)), opd_none);
+		var->loaded=c->line;
+	}
+	VAR(now)=v;
+	VAL(now)=var->val;
+}
+
+static void turn_to_reg(Compiler *c, Node *ast)
+{
+	// Post-order walk, see new_frame. Operands have no children, so they are turned without a
+	// frame of their own.
+	if(isOperand(KIND(*ast)))
+	{
+		if(KIND(*ast)==Variable)
+			turn_to_reg_var(c, *ast);
+		return ;
+	}
+	c->frames.len=0;
+	Node now=*ast;
+	int state=0;
+	for(;;)
+	{
+		Node next=0;
+		if(KIND(now)==Assign)
+		{
+			if(state==0)
+				next=RHS(now);
+			state=3;
 		}
 		else
 		{
-			codegen(ast->lhs);
-			codegen(ast->rhs);
-			if((ast->lhs)->type==Value&&(ast->rhs)->type==Value)
+			if(state==0)
+			{
+				state=1;
+				next=LHS(now);
+			}
+			if(next==0&&state==1)
 			{
-				switch(ast->type)
+				state=2;
+				if(MID(now)!=0)
 				{
-					case(Add):
-						ast->val=(ast->lhs)->val+(ast->rhs)->val;
-						break;
-					case(Sub):
-						ast->val=(ast->lhs)->val-(ast->rhs)->val;
-						break;
-					case(Mul):
-						ast->val=(ast->lhs)->val*(ast->rhs)->val;
-						break;
-					case(Div):
-						ast->val=(ast->lhs)->val/(ast->rhs)->val;
-						break;
-					case(Rem):
-						ast->val=(ast->lhs)->val%(ast->rhs)->val;
-						break;
+					if(getOpLevel(KIND(now))==1)
+					{
+						// Codegen reads the variable right under the operator. The other
+						// variables in its register keep their value, so it is loaded into a
+						// register of its own.
+						MID(now)=strip_par(c, MID(now));
+						int v=VAL(MID(now)), r=c->store[v].val;
+						if(r>=0&&c->holders[r]>1)
+						{
+							var_set_reg(c, v, c->reg++);
+							c->store[v].loaded=0;
+						}
+					}
+					next=MID(now);
 				}
-				ast->type=Value;
-				free(ast->lhs);
-				free(ast->rhs);
-				ast->lhs=NULL;
-				ast->rhs=NULL;
-				return ;
-			}
-			else if(ast->type==Value)
-				return ;
-			else if(ast->type==Add)
-				printf("add ");
-			else if(ast->type==Sub)
-				printf("sub ");
-			else if(ast->type==Mul)
-				printf("mul ");
-			else if(ast->type==Div)
-				printf("div ");
-			else if(ast->type==Rem)
-				printf("rem ");
-			else;
-
-			if((ast->lhs)->type!=Variable&&(ast->lhs)->type!=Value)
+			}
+			if(next==0&&state==2)
+			{
+				state=3;
+				next=RHS(now);
+			}
+		}
+		if(next==0)
+		{
+			if(c->frames.len==0)
+				break;
+			Frame *f=&c->frames.arr[--c->frames.len];
+			now=f->node;
+			state=f->state;
+		}
+		else if(KIND(next)==Variable)
+			turn_to_reg_var(c, next);
+		else if(KIND(next)!=Value&&!share_seen(c, next, ShareTurned))
+		{
+			new_frame(c, now, state);
+			now=next;
+			state=0;
+		}
+	}
+	return ;
+}
+
+static void codegen_prefix(Compiler *c, Node ast)
+{
+	Operand var=opd_reg(VAL(MID(ast)));
+	if(KIND(ast)==PreInc)
+		ir_append(c, OpAdd, var, var, opd_imm(1));
+	else if(KIND(ast)==PreDec)
+		ir_append(c, OpSub, var, var, opd_imm(1));
+	else;
+	if(ast==c->first)
+	{
+		ir_append(c, OpStore, opd_mem(var_memory(c, MID(ast))), var, opd_none);
+	}
+	KIND(ast)=KIND(MID(ast));
+	VAL(ast)=VAL(MID(ast));
+	VAR(ast)=VAR(MID(ast));
+	MID(ast)=0;
+}
+
+// Whether codegen has work to do at "ast" below the root. Operands and postfix operators are
+// left to the operator above them.
+static int has_codegen(Compiler *c, Node ast)
+{
+	return (KIND(ast)==LPar||getOpLevel(KIND(ast))>=2)&&!share_seen(c, ast, ShareGenerated);
+}
+
+static void codegen(Compiler *c, Node ast)
+{
+	// Post-order walk, see new_frame, except that "state" counts the children of "ast" already
+	// generated.
+	c->frames.len=0;
+	int state=0;
+	for(;;)
+	{
+		Node next=0;
+		if (KIND(ast)==PreInc||KIND(ast)==PreDec)
+			codegen_prefix(c, ast);
+		else if(KIND(ast)==LPar)
+		{
+			// Nested parentheses group like one pair, and an operand in them is the operand.
+			MID(ast)=strip_par(c, MID(ast));
+			if(isOperand(KIND(MID(ast))))
 			{
-				if(ast->val==-1)
-					ast->val=(ast->lhs)->val;	
+				Node tmp=MID(ast);
+				KIND(ast)=KIND(tmp);
+				VAL(ast)=VAL(tmp);
+				VAR(ast)=VAR(tmp);
+				MID(ast)=0;
 			}
-			else if((ast->rhs)->type!=Variable&&(ast->rhs)->type!=Value)
+			else if(isUnary(KIND(MID(ast))))
 			{
-				if(ast->val==-1)
-					ast->val=(ast->rhs)->val;
+				Node tmp=MID(ast);
+				KIND(ast)=KIND(MID(ast));
+				VAL(ast)=VAL(MID(ast));
+				MID(ast)=MID(tmp);
 			}
-			else
+			if(isBinaryOperator(KIND(MID(ast))))
 			{
-				if(ast->val==-1)
-					ast->val=reg++;
-			}
-			printf("r%d ", ast->val);
-			
-			if((ast->lhs)->type==Variable)
-				printf("r%d ", (ast->lhs)->val);
-			else if((ast->lhs)->type==Value)
-				printf("%d ", (ast->lhs)->val);
-			else if((ast->lhs)->type==PostInc||(ast->lhs)->type==PostDec)
-				printf("r%d ", ((ast->lhs)->mid)->val);
-			else
-				printf("r%d ", (ast->lhs)->val);
-			if((ast->rhs)->type==Variable)
-				printf("r%d \n",(ast->rhs)->val);
-			else if((ast->rhs)->type==Value)
-				printf("%d \n", (ast->rhs)->val);
-			else if((ast->rhs)->type==PostInc||(ast->rhs)->type==PostDec)
-				printf("r%d \n", ((ast->rhs)->mid)->val);
-			else
-				printf("r%d \n", (ast->rhs)->val);
-			if((ast->lhs)->type==PostInc||(ast->lhs)->type==PostDec)
+				Node tmp=MID(ast);
+				KIND(ast)=KIND(MID(ast));
+				VAL(ast)=VAL(MID(ast));
+				LHS(ast)=LHS(tmp);
+				RHS(ast)=RHS(tmp);
+				MID(ast)=0;
+			}
+			// Generate the node again as what it became.
+			continue;
+		}
+		else if(isPlusMinus(KIND(ast)))
+		{
+			int i=0;
+			if(KIND(ast)==Minus)
+				++i;
+			while(KIND(MID(ast))!=Variable&&KIND(MID(ast))!=Value)
 			{
-				if((ast->lhs)->type==PostInc)
+				if(KIND(MID(ast))==LPar)
+				{
+					Node ignore=MID(ast);
+					MID(ast)=MID(ignore);
+				}
+				if(KIND(MID(ast))==PreInc||KIND(MID(ast))==PreDec)
+					codegen_prefix(c, MID(ast));
+				if(KIND(MID(ast))!=Variable&&KIND(MID(ast))!=Value)
 				{
-					printf("add r%d r%d 1\n", ((ast->lhs)->mid)->val, ((ast->lhs)->mid)->val);
-					(ast->lhs)->type=((ast->lhs)->mid)->type;
-					(ast->lhs)->val=((ast->lhs)->mid)->val;
-					free((ast->lhs)->mid);
-					(ast->lhs)->mid=NULL;
+					Node del=MID(ast);
+					if(KIND(del)==Minus)
+						++i;
+					MID(ast)=MID(del);
 				}
-				else if((ast->lhs)->type==PostDec)
+			}
+		
+			if(i%2==0)
+			{
+				KIND(ast)=KIND(MID(ast));
+				VAL(ast)=VAL(MID(ast));
+			}
+			else
+			{
+				KIND(ast)=Minus;
+				if(KIND(MID(ast))==Value)
 				{
-					printf("sub r%d r%d 1", ((ast->lhs)->mid)->val, ((ast->lhs)->mid)->val);
-					(ast->lhs)->type=((ast->lhs)->mid)->type;
-					(ast->lhs)->val=((ast->lhs)->mid)->val;
-					free((ast->lhs)->mid);
-					(ast->lhs)->mid=NULL;
+					KIND(ast)=Value;
+					VAL(ast)=-VAL(MID(ast));
 				}
-				if((ast->lhs)->val==store[0].val)
-					printf("store [0] r%d\n", (ast->lhs)->val);
-				else if((ast->lhs)->val==store[1].val)
-					printf("store [4] r%d\n", (ast->lhs)->val);
 				else
-					printf("store [8] r%d\n", (ast->lhs)->val);	
+				{
+					if(VAL(ast)==-1)
+						VAL(ast)=c->reg++;
+					ir_append(c, OpSub, opd_reg(VAL(ast)), opd_imm(0), opd_reg(VAL(MID(ast))));
+					KIND(ast)=Variable;
+				}	
 			}
-			else;
-
-			if((ast->rhs)->type==PostInc||(ast->rhs)->type==PostDec)
+			MID(ast)=0;
+		}
+		else if(isBinaryOperator(KIND(ast))&&KIND(ast)!=Assign)
+		{
+			if(state==0&&(KIND(LHS(ast))!=Value||KIND(RHS(ast))!=Value))
+			{
+				state=1;
+				if(has_codegen(c, LHS(ast)))
+					next=LHS(ast);
+			}
+			if(next==0&&state==1)
+			{
+				state=2;
+				if(has_codegen(c, RHS(ast)))
+					next=RHS(ast);
+			}
+			if(next!=0);
+			else if(KIND(LHS(ast))==Value&&KIND(RHS(ast))==Value&&
+				const_eval(binary_op(KIND(ast)), VAL(LHS(ast)), VAL(RHS(ast)), &VAL(ast)))
+			{
+				KIND(ast)=Value;
+				LHS(ast)=0;
+				RHS(ast)=0;
+			}
+			else if(KIND(ast)!=Value)
 			{
-				if((ast->rhs)->type==PostInc)
+				// Constants only get here when their division would trap, and the machine
+				// runs it as written.
+				int op=binary_op(KIND(ast));
+
+				if(KIND(LHS(ast))!=Variable&&KIND(LHS(ast))!=Value&&!share_many(c, LHS(ast)))
 				{
-					printf("add r%d r%d 1", ((ast->rhs)->mid)->val, ((ast->rhs)->mid)->val);
-					(ast->rhs)->type=((ast->rhs)->mid)->type;
-					(ast->rhs)->val=((ast->rhs)->mid)->val;
-					free((ast->rhs)->mid);
-					(ast->rhs)->mid=NULL;
+					if(VAL(ast)==-1)
+						VAL(ast)=VAL(LHS(ast));	
 				}
-				else if((ast->rhs)->type==PostDec)
+				else if(KIND(RHS(ast))!=Variable&&KIND(RHS(ast))!=Value&&!share_many(c, RHS(ast)))
 				{
-					printf("sub r%d r%d 1", ((ast->rhs)->mid)->val, ((ast->rhs)->mid)->val);
-					(ast->rhs)->type=((ast->rhs)->mid)->type;
-					(ast->rhs)->val=((ast->rhs)->mid)->val;
-					free((ast->rhs)->mid);
-					(ast->rhs)->mid=NULL;
+					if(VAL(ast)==-1)
+						VAL(ast)=VAL(RHS(ast));
 				}
-				if((ast->rhs)->val==store[0].val)
-					printf("store [0] r%d\n", (ast->rhs)->val);
-				else if((ast->rhs)->val==store[1].val)
-					printf("store [4] r%d\n", (ast->rhs)->val);
 				else
-					printf("store [8] r%d\n", (ast->rhs)->val);	
-			}
-			else;
-		}	
-		free(ast->lhs);
-		free(ast->rhs);
-		ast->lhs=NULL;
-		ast->rhs=NULL;
-		return ;
-	}
-	else if(ast->type==Assign)
-	{
-		if((ast->lhs)->type==Variable)
-		{	
-			if((ast->lhs)->val=='x')
-			{
-				if(store[0].val!=-1)
-					if((ast->rhs)->type!=Value&&(ast->rhs)->type!=Variable)
+				{
+					if(VAL(ast)==-1)
+						VAL(ast)=c->reg++;
+				}
+				ir_append(c, op, opd_reg(VAL(ast)), node_operand(c, LHS(ast)), node_operand(c, RHS(ast)));
+				if(KIND(LHS(ast))==PostInc||KIND(LHS(ast))==PostDec)
+				{
+					if(KIND(LHS(ast))==PostInc)
 					{
-						ast->val=store[0].val;
-						(ast->rhs)->val=store[0].val;
+						ir_append(c, OpAdd, node_operand(c, LHS(ast)), node_operand(c, LHS(ast)), opd_imm(1));
+						KIND(LHS(ast))=KIND(MID(LHS(ast)));
+						VAL(LHS(ast))=VAL(MID(LHS(ast)));
+						VAR(LHS(ast))=VAR(MID(LHS(ast)));
+						MID(LHS(ast))=0;
 					}
-			}
-			else if((ast->lhs)->val=='y')
-			{
-				if(store[1].val!=-1)
-					if((ast->rhs)->type!=Value&&(ast->rhs)->type!=Variable)
+					else if(KIND(LHS(ast))==PostDec)
 					{
-						ast->val=store[1].val;
-						(ast->rhs)->val=store[1].val;
+						ir_append(c, OpSub, node_operand(c, LHS(ast)), node_operand(c, LHS(ast)), opd_imm(1));
+						KIND(LHS(ast))=KIND(MID(LHS(ast)));
+						VAL(LHS(ast))=VAL(MID(LHS(ast)));
+						VAR(LHS(ast))=VAR(MID(LHS(ast)));
+						MID(LHS(ast))=0;
 					}
-			}
-			else
-			{
-				if(store[2].val!=-1)
-					if((ast->rhs)->type!=Value&&(ast->rhs)->type!=Variable)
+					ir_append(c, OpStore, opd_mem(var_memory(c, LHS(ast))), opd_reg(VAL(LHS(ast))), opd_none);
+				}
+				else;
+
+				if(KIND(RHS(ast))==PostInc||KIND(RHS(ast))==PostDec)
+				{
+					if(KIND(RHS(ast))==PostInc)
 					{
-						ast->val=store[2].val;
-						(ast->rhs)->val=store[2].val;
+						ir_append(c, OpAdd, node_operand(c, RHS(ast)), node_operand(c, RHS(ast)), opd_imm(1));
+						KIND(RHS(ast))=KIND(MID(RHS(ast)));
+						VAL(RHS(ast))=VAL(MID(RHS(ast)));
+						VAR(RHS(ast))=VAR(MID(RHS(ast)));
+						MID(RHS(ast))=0;
 					}
+					else if(KIND(RHS(ast))==PostDec)
+					{
+						ir_append(c, OpSub, node_operand(c, RHS(ast)), node_operand(c, RHS(ast)), opd_imm(1));
+						KIND(RHS(ast))=KIND(MID(RHS(ast)));
+						VAL(RHS(ast))=VAL(MID(RHS(ast)));
+						VAR(RHS(ast))=VAR(MID(RHS(ast)));
+						MID(RHS(ast))=0;
+					}
+					ir_append(c, OpStore, opd_mem(var_memory(c, RHS(ast))), opd_reg(VAL(RHS(ast))), opd_none);
+				}
+				else;
+				LHS(ast)=0;
+				RHS(ast)=0;
 			}
-			if((ast->rhs)->type==LPar)
-				((ast->rhs)->mid)->val=(ast->rhs)->val;
-
 		}
-		codegen(ast->rhs);
-		if((ast->lhs)->type==Variable)
+		else if(KIND(ast)==Assign)
 		{
-			if((ast->rhs)->type==Value)
-			{
-				int val=reg++;
-				printf("mul r%d %d 1\n", val, (ast->rhs)->val);
-				(ast->rhs)->val=val;
-				(ast->rhs)->type=Variable;
-			}
-			printf("store ");
-			if((ast->lhs)->val=='x')
-				printf("[0] ");
-			else if((ast->lhs)->val=='y')
-				printf("[4] ");
-			else
-				printf("[8] ");
-			if(getOpLevel((ast->rhs)->type)==1)
+			if(state==0)
 			{
-				printf("r%d\n", ((ast->rhs)->mid)->val);
+				if(KIND(LHS(ast))==Variable)
+				{	
+					VarReg *var=&c->store[VAL(LHS(ast))];
+					// An operator that computes a new value may compute it straight into the
+					// register of the variable. Parentheses and an inner "=" hand on a value
+					// that lives in a register of its own, which must not be overwritten.
+					if(var->val!=-1)
+						if((isOp(KIND(RHS(ast)))&&KIND(RHS(ast))!=Assign)||isPlusMinus(KIND(RHS(ast))))
+						{
+							VAL(ast)=var->val;
+							VAL(RHS(ast))=var->val;
+						}
+					if(KIND(RHS(ast))==LPar)
+						MID(RHS(ast))=strip_par(c, MID(RHS(ast)));
+				}
+				state=1;
+				if(has_codegen(c, RHS(ast)))
+					next=RHS(ast);
 			}
-			else if(getOpLevel((ast->rhs)->type)==14)
+			if(next==0)
 			{
-				if((ast->rhs)->rhs!=NULL)
+				if(KIND(LHS(ast))==Variable)
 				{
-					while(getOpLevel((ast->rhs)->type)==14)
+					if(KIND(RHS(ast))==Value)
 					{
-							AST *del=ast->rhs;
-							ast->rhs=del->rhs;
-							free(del);
+						// The constant, maybe folded from an operator that was meant to compute
+						// into the variable's register, gets a register of its own.
+						int val=c->reg++;
+						ir_append(c, OpMul, opd_reg(val), opd_imm(VAL(RHS(ast))), opd_imm(1));
+						VAL(RHS(ast))=val;
+						KIND(RHS(ast))=Variable;
+						VAL(ast)=val;
 					}
-					if(getOpLevel((ast->rhs)->type==1))
+					Operand slot=opd_mem(VAR_SLOT(VAL(LHS(ast))));
+					if(getOpLevel(KIND(RHS(ast)))==1)
 					{
-						printf("r%d\n", ((ast->rhs)->mid)->val);
-						if((ast->rhs)->type==PostInc)
-							printf("add r%d r%d 1\n", ((ast->rhs)->mid)->val, ((ast->rhs)->mid)->val);
-						else
-							printf("sub r%d r%d 1\n", ((ast->rhs)->mid)->val, ((ast->rhs)->mid)->val);
-						if(((ast->rhs)->mid)->val==store[0].val)
-							printf("store [0] r%d\n", ((ast->rhs)->mid)->val);
-						else if(((ast->rhs)->mid)->val==store[1].val)
-							printf("store [4] r%d\n", ((ast->rhs)->mid)->val);
+						ir_append(c, OpStore, slot, node_operand(c, RHS(ast)), opd_none);
+					}
+					else if(getOpLevel(KIND(RHS(ast)))==14)
+					{
+						if(RHS(RHS(ast))!=0)
+						{
+							while(getOpLevel(KIND(RHS(ast)))==14)
+							{
+									Node del=RHS(ast);
+									RHS(ast)=RHS(del);
+							}
+							if(getOpLevel(KIND(RHS(ast))==1))
+							{
+								Operand var=opd_reg(VAL(MID(RHS(ast))));
+								ir_append(c, OpStore, slot, var, opd_none);
+								if(KIND(RHS(ast))==PostInc)
+									ir_append(c, OpAdd, var, var, opd_imm(1));
+								else
+									ir_append(c, OpSub, var, var, opd_imm(1));
+								ir_append(c, OpStore, opd_mem(var_memory(c, RHS(ast))), var, opd_none);
+								KIND(RHS(ast))=KIND(MID(RHS(ast)));
+								VAL(RHS(ast))=VAL(MID(RHS(ast)));
+								MID(RHS(ast))=0;
+							}
+						}
 						else
-							printf("store [8] r%d\n", ((ast->rhs)->mid));
-						(ast->rhs)->type=((ast->rhs)->mid)->type;
-						(ast->rhs)->val=((ast->rhs)->mid)->val;
-						free((ast->rhs)->mid);
-						(ast->rhs)->mid=NULL;
+						{
+							ir_append(c, OpStore, slot, opd_reg(VAL(RHS(ast))), opd_none);
+							var_set_reg(c, VAL(LHS(ast)), VAL(RHS(ast)));
+						}
+					}
+					else
+					{
+						ir_append(c, OpStore, slot, opd_reg(VAL(RHS(ast))), opd_none);
+						var_set_reg(c, VAL(LHS(ast)), VAL(RHS(ast)));
+					}
+					if(VAL(ast)==-1)
+					{
+						if(getOpLevel(KIND(RHS(ast)))==1)
+							VAL(RHS(ast))=VAL(MID(RHS(ast)));
+						VAL(ast)=VAL(RHS(ast));
+					}
+					if(getOpLevel(KIND(RHS(ast)))==1)
+					{
+						LHS(ast)=0;
 					}
-				}
-				else
-				{
-					printf("r%d\n", (ast->rhs)->val);
-					if((ast->lhs)->val=='x')
-						store[0].val=(ast->rhs)->val;
-					else if((ast->lhs)->val=='y')
-						store[1].val=(ast->rhs)->val;
 					else
-						store[2].val=(ast->rhs)->val;
+					{
+						LHS(ast)=0;
+						RHS(ast)=0;
+					}
 				}
 			}
-			else
-			{
-				printf("r%d\n", (ast->rhs)->val);	
-				if((ast->lhs)->val=='x')
-					store[0].val=(ast->rhs)->val;
-				else if((ast->lhs)->val=='y')
-					store[1].val=(ast->rhs)->val;
-				else
-					store[2].val=(ast->rhs)->val;
-			}
-			if(ast->val==-1)
-			{
-				if(getOpLevel((ast->rhs)->type)==1)
-					(ast->rhs)->val=((ast->rhs)->mid)->val;
-				ast->val=(ast->rhs)->val;
-			}
-			if(getOpLevel((ast->rhs)->type)==1)
-			{
-				free(ast->lhs);
-				ast->lhs=NULL;
-			}
-			else
-			{
-				free(ast->lhs);
-				free(ast->rhs);
-				ast->lhs=NULL;
-				ast->rhs=NULL;
-			}
 		}
-		return ;
-	}
-	else//value, variable, postinc, postdec
-	{
-		if(ast=first)
+		else//value, variable, postinc, postdec
 		{
-			if(getOpLevel(ast->type)==1)
+			if(ast=c->first)
 			{
-				if(ast->type==PostInc)
-					printf("add r%d r%d 1\n", (ast->mid)->val, (ast->mid)->val);
-				else if(ast->type==PostDec)
-					printf("sub r%d r%d 1\n", (ast->mid)->val, (ast->mid)->val);
-				printf("store ");
-				if((ast->mid)->val==store[0].val)
-					printf("[0] ");
-				else if((ast->mid)->val==store[1].val)
-					printf("[4] ");
-				else if((ast->mid)->val==store[2].val)
-					printf("[8] ");
-				else;
-				printf("r%d\n", (ast->mid)->val);
+				if(getOpLevel(KIND(ast))==1)
+				{
+					Operand var=opd_reg(VAL(MID(ast)));
+					if(KIND(ast)==PostInc)
+						ir_append(c, OpAdd, var, var, opd_imm(1));
+					else if(KIND(ast)==PostDec)
+						ir_append(c, OpSub, var, var, opd_imm(1));
+					ir_append(c, OpStore, opd_mem(var_memory(c, ast)), var, opd_none);
+				}
 			}
 		}
-		else
-			return ;
+		if(next!=0)
+		{
+			new_frame(c, ast, state);
+			ast=next;
+			state=0;
+			continue;
+		}
+		if(c->frames.len==0)
+			break;
+		Frame *f=&c->frames.arr[--c->frames.len];
+		ast=f->node;
+		state=f->state;
 	}
 }
 	// TODO: Implement your own codegen.
 	// You may modify the pass parameter(s) or the return type as you wish.
 
-void err() {
-	puts("Compile Error!");
-	exit(0);
+static void err(Compiler *c) {
+	longjmp(c->fail, 1);
 }
 
-Token *new_token(int kind, int param) {
-	Token *res = (Token*)malloc(sizeof(Token));
-	res->kind = kind;
-	res->param = param;
-	res->prev = res->next = NULL;
-	return res;
+#ifndef COMPILER_NO_MAIN
+static void print_error(Compiler *c) {
+	static const char msg[] = "Compile Error!\n";
+	ir_flush(c, 0);
+	emit_flush(&c->out);
+	write_all(c->out.fd, msg, sizeof(msg) - 1);
 }
+#endif
 
-AST* new_AST(Token *mid) {
-	AST *newN = (AST*)malloc(sizeof(AST));
-	newN->lhs = newN->mid = newN->rhs = NULL;
-	newN->type = mid->kind;
-	newN->val = mid->param;
-	return newN;
-}
-int list_to_arr(Token **head) {
-	int res = 0;
-	Token *now = (*head), *t_head = NULL, *del;
-	while(now!=NULL) {
-		res++;
-		now = now->next;
-	}
-	now = (*head);
-	t_head = (Token*)malloc(sizeof(Token)*res);
-	for(int i = 0; i < res; i++) {
-		t_head[i] = (*now);
-		del = now;
-		now = now->next;
-		free(del);
-	}
-	(*head) = t_head;
+static Operand opd_reg(int r) {
+	Operand res = {OpdReg, r};
 	return res;
 }
-int isBinaryOperator(int kind) {
-	int res = getOpLevel(kind);
-	if(res >= 3) return 1;
-	return 0;
-}
-
-int isOp(int x) {
-	return Mul <= x && x <= Assign;
-}
 
-int isUnary(int x) {
-	return PostInc <= x && x <= Minus;
+static Operand opd_imm(int v) {
+	Operand res = {OpdImm, v};
+	return res;
 }
 
-int isPar(int x) {
-	return LPar <= x && x<= RPar;
+static Operand opd_mem(int m) {
+	Operand res = {OpdMem, m};
+	return res;
 }
 
-int isPlusMinus(int x) {
-	if(x == Plus) return 1;
-	if(x == Minus) return 1;
-	return 0;
+static Operand node_operand(Compiler *c, Node ast) {
+	if(KIND(ast)==Value)
+		return opd_imm(VAL(ast));
+	if(KIND(ast)==PostInc||KIND(ast)==PostDec)
+		return opd_reg(VAL(MID(ast)));
+	return opd_reg(VAL(ast));
 }
 
-int isOperand(int x) {
-	if(x == Value) return 1;
-	if(x == Variable) return 1;
-	return 0;
+static int binary_op(int kind) {
+	switch(kind) {
+		case Sub: return OpSub;
+		case Mul: return OpMul;
+		case Div: return OpDiv;
+		case Rem: return OpRem;
+		default: return OpAdd;
+	}
 }
 
-int getOpLevel(int kind) {
-	int res;
-	if(kind <= Variable) res = -1;
-	else if(kind <= PostDec) res = 1;
-	else if(kind <= Minus) res = 2;
-	else if(kind <= Rem) res = 3;
-	else if(kind <= Sub) res = 4;
-	else if(kind <= Assign) res = 14;
-	else res = -1;
-	return res;
+static void ir_append(Compiler *c, int op, Operand d, Operand a, Operand b) {
+	c->report.stats.generated[op]++;
+	ir_push(&c->ir, op, d, a, b);
 }
 
-int findParPair(Token *arr, int tar, int r) {
-	if(arr[tar].kind != LPar) return -1;
-	for(int i = tar + 1; i <= r; i++)
-		if(arr[i].kind == RPar)
-			if(arr[i].param == arr[tar].param)
-				return i;
-	return -1;
+static void ir_push(IR *ir, int op, Operand d, Operand a, Operand b) {
+	if(ir->len == ir->cap) {
+		ir->cap = ir->cap ? ir->cap * 2 : 256;
+		ir->arr = (Instr*)realloc(ir->arr, sizeof(Instr) * ir->cap);
+		if(ir->arr == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	Instr *res = &ir->arr[ir->len++];
+	res->op = op;
+	res->d = d;
+	res->a = a;
+	res->b = b;
 }
 
-int nextSection(Token *arr, int l, int r) {
-	int res = l;
-	if(arr[l].kind == LPar) {
-		res = findParPair(arr, l, r);
-		if(res == -1) err();
+static void ir_flush(Compiler *c, int keep) {
+	IR *ir = &c->ir;
+	Options *opt = &c->opt;
+	Report *rep = &c->report;
+	long t = opt->stats ? now_ns() : 0;
+	if(opt->constprop)
+		rep->constprop += constprop(&c->constprop, ir, c->ir_done);
+	if(opt->gvn)
+		rep->gvn += gvn(&c->gvn, ir, c->ir_done);
+	if(opt->sink && keep == 0)
+		sink_stores(ir, &rep->sink);
+	if(opt->peephole)
+		rep->peephole += peephole(ir, opt->peephole, keep == 0);
+	if(opt->regs && keep == 0)
+		regalloc(ir, opt->regs, VAR_SLOT(c->sym.len), &rep->regalloc);
+	int n = ir->len > keep ? ir->len - keep : 0;
+	if(opt->stats) {
+		t = stats_phase(&rep->stats, PhaseOptimize, t);
+		for(int i = 0; i < n; i++)
+			rep->stats.emitted[ir->arr[i].op]++;
 	}
-	return res + 1;
+	if(opt->simulate)
+		for(int i = 0; i < n; i++)
+			simulate(&c->machine, &ir->arr[i], &rep->sim);
+	for(int i = 0; i < n; i++)
+		emit(&c->out, ir->arr[i].op, ir->arr[i].d, ir->arr[i].a, ir->arr[i].b);
+	if(opt->stats) stats_phase(&rep->stats, PhaseEmit, t);
+	// Nothing may have been appended yet, and then there is no buffer to move.
+	if(n > 0)
+		memmove(ir->arr, ir->arr + n, sizeof(Instr) * (ir->len - n));
+	ir->len -= n;
+	c->ir_done = ir->len;
 }
 
-int find_Tmid(Token *arr, int l, int r) {
-	int big = l;
-	for(int i = l; i <= r;) {
-		if(getOpLevel(arr[big].kind) <= getOpLevel(arr[i].kind)) {
-			if(isPlusMinus(arr[big].kind) && isPlusMinus(arr[i].kind));
-			else if(getOpLevel(arr[big].kind) != 14)
-            {
-				big = i;
-            }
-		}
-		i = nextSection(arr, i, r);
+// Peephole optimizer
+//
+// Instructions already printed have run on the machine and can't change. Code that is not
+// generated yet may still read any register or memory slot, so a register is only dead once
+// the IR defines it again, unless "final" says the program ends with the IR.
+
+// Marks an instruction removed until the IR is compacted.
+#define OP_DEAD -1
+// How far forwarding looks for the reads of a register.
+#define PEEPHOLE_HORIZON 64
+
+static void *xrealloc(void *p, size_t size) {
+	p = realloc(p, size);
+	if(p == NULL) {
+		perror("realloc");
+		exit(1);
 	}
-	return big;
+	return p;
+}
+
+// Register written by "x", or -1.
+static int def_reg(Instr *x) {
+	if(x->op == OpStore || x->d.kind != OpdReg) return -1;
+	return x->d.val;
+}
+
+static int reads_reg(Instr *x, int r) {
+	return (x->a.kind == OpdReg && x->a.val == r) || (x->b.kind == OpdReg && x->b.val == r);
+}
+
+// Memory slot touched by a load or a store, or -1.
+static int mem_slot(Instr *x) {
+	if(x->op == OpLoad) return x->a.val;
+	if(x->op == OpStore) return x->d.val;
+	return -1;
 }
 
-int var_memory(AST *ast) {
-	while(ast->type != Variable)
-		ast = ast->mid;
-	
-	switch(ast->val) {
-		case 'x': return 0;
-		case 'y': return 4;
-		case 'z': return 8;
-		default: 
-			err();
+static int const_eval(int op, int a, int b, int *res) {
+	if((op == OpDiv || op == OpRem) && (b == 0 || (a == INT_MIN && b == -1)))
+		return 0;
+	switch(op) {
+		case OpAdd: *res = (int)((unsigned)a + (unsigned)b); break;
+		case OpSub: *res = (int)((unsigned)a - (unsigned)b); break;
+		case OpMul: *res = (int)((unsigned)a * (unsigned)b); break;
+		case OpDiv: *res = a / b; break;
+		default: *res = a % b; break;
+	}
+	return 1;
+}
+
+// If "x" only copies a value, such as "add rD rS 0" or "mul rD 3 1", store it in "src".
+static int copy_source(Instr *x, Operand *src) {
+	Operand a = x->a, b = x->b;
+	int ai = a.kind == OpdImm, bi = b.kind == OpdImm;
+	if(x->op == OpLoad || x->op == OpStore) return 0;
+	if(ai && bi) {
+		src->kind = OpdImm;
+		return const_eval(x->op, a.val, b.val, &src->val);
+	}
+	if((x->op == OpAdd && ai && a.val == 0) || (x->op == OpMul && ai && a.val == 1)) {
+		*src = b;
+		return 1;
+	}
+	if((x->op == OpAdd || x->op == OpSub) && bi && b.val == 0) {
+		*src = a;
+		return 1;
+	}
+	if((x->op == OpMul || x->op == OpDiv) && bi && b.val == 1) {
+		*src = a;
+		return 1;
+	}
+	return 0;
+}
+
+// Replace the reads of register "r" after instruction "at", up to its next definition, by "with".
+// A register replacement must reach every read unchanged, otherwise nothing is rewritten.
+// An immediate can't go into a store, so those reads stay. Return the number of reads left on "r".
+// Only PEEPHOLE_HORIZON instructions are searched; reads past them count as left.
+static int forward_operand(IR *ir, int at, int r, Operand with, int final) {
+	int left = 0, k, end = at + 1 + PEEPHOLE_HORIZON;
+	if(end > ir->len) end = ir->len;
+	if(with.kind == OpdReg && with.val == r)
+		return 0;
+	if(with.kind == OpdReg) {
+		for(k = at + 1; k < end; k++) {
+			Instr *x = &ir->arr[k];
+			if(x->op == OP_DEAD) continue;
+			if(reads_reg(x, r)) {
+				for(int m = at + 1; m < k; m++)
+					if(ir->arr[m].op != OP_DEAD && def_reg(&ir->arr[m]) == with.val)
+						return -1;
+			}
+			if(def_reg(x) == r) break;
+		}
+		// Later code may read "r" too.
+		if(k == end && (end < ir->len || !final))
 			return -1;
 	}
+	for(k = at + 1; k < end; k++) {
+		Instr *x = &ir->arr[k];
+		if(x->op == OP_DEAD) continue;
+		Operand *opd[2] = {&x->a, &x->b};
+		for(int t = 0; t < 2; t++) {
+			if(opd[t]->kind != OpdReg || opd[t]->val != r) continue;
+			if(with.kind == OpdImm && x->op == OpStore) left++;
+			else *opd[t] = with;
+		}
+		if(def_reg(x) == r) break;
+	}
+	if(k == end && (end < ir->len || !final))
+		left++;
+	return left;
 }
 
-void AST_print(AST *head, int indent) {
-	if(head == NULL) return;
-	const char kind_only[] = "<%s>\n";
-	const char kind_para[] = "<%s>, <%s = %d>\n";
-	for(int i=0;i<indent;i++) printf("  ");
-	switch(head->type) {
-		case LPar:
-		case RPar:
-		case PostInc:
-		case PostDec:
-		case PreInc:
-		case PreDec:
-		case Plus:
-		case Minus:
-		case Mul:
-		case Div:
-		case Rem:
-		case Add:
-		case Sub:
-		case Assign:
-			printf(kind_only, TYPE[head->type]);
+// Mark in "dead" the instructions whose register is not read before being defined again,
+// sweeping backwards with one liveness bit per register in "live", which has room for the
+// registers from "lo" on that the instructions use.
+static void dead_defs(IR *ir, int final, char *dead, char *live, int lo, int n) {
+	memset(live, !final, n);
+	for(int i = ir->len - 1; i >= 0; i--) {
+		Instr *x = &ir->arr[i];
+		int r = def_reg(x);
+		dead[i] = 0;
+		if(x->op == OP_DEAD) continue;
+		if(r != -1) {
+			dead[i] = !live[r - lo];
+			live[r - lo] = 0;
+		}
+		if(x->a.kind == OpdReg) live[x->a.val - lo] = 1;
+		if(x->b.kind == OpdReg) live[x->b.val - lo] = 1;
+	}
+}
+
+static int peephole(IR *ir, int window, int final) {
+	int removed = 0, changed = 1;
+	char *dead = (char*)xrealloc(NULL, ir->len + 1);
+	// Register numbers grow over the whole program, so the liveness bits only span the ones in
+	// the window. Rewrites only put registers of the window in place of others.
+	int lo = INT_MAX, hi = INT_MIN;
+	for(int i = 0; i < ir->len; i++) {
+		Operand *opd[3] = {&ir->arr[i].d, &ir->arr[i].a, &ir->arr[i].b};
+		for(int t = 0; t < 3; t++)
+			if(opd[t]->kind == OpdReg) {
+				if(opd[t]->val < lo) lo = opd[t]->val;
+				if(opd[t]->val > hi) hi = opd[t]->val;
+			}
+	}
+	if(lo > hi) lo = hi = 0;
+	char *live = (char*)xrealloc(NULL, hi - lo + 1);
+	for(int round = 0; changed && round < 8; round++) {
+		changed = 0;
+		dead_defs(ir, final, dead, live, lo, hi - lo + 1);
+		for(int i = 0; i < ir->len; i++) {
+			Instr *x = &ir->arr[i];
+			if(x->op == OP_DEAD) continue;
+			int r = def_reg(x), slot = mem_slot(x);
+			Operand src;
+
+			// Copies and constants: "add rD rS 0", "mul rD rS 1", "mul rD c 1", ...
+			if(r != -1 && copy_source(x, &src)) {
+				if(src.kind == OpdReg && src.val == r) {
+					x->op = OP_DEAD;
+					removed++, changed = 1;
+					continue;
+				}
+				int left = forward_operand(ir, i, r, src, final);
+				if(left == 0) {
+					x->op = OP_DEAD;
+					removed++, changed = 1;
+					continue;
+				}
+				if(src.kind == OpdImm && (x->op != OpMul || x->a.kind != OpdImm || x->a.val != src.val || x->b.val != 1)) {
+					// Keep the constant for the store but in its canonical "mul rD c 1" form.
+					x->op = OpMul;
+					x->a = src;
+					x->b = opd_imm(1);
+					changed = 1;
+				}
+			}
+
+			// A register nobody reads.
+			if(r != -1 && dead[i]) {
+				x->op = OP_DEAD;
+				removed++, changed = 1;
+				continue;
+			}
+
+			if(slot == -1) continue;
+			// The register holding the value of "slot" after instruction i, -1 once it is overwritten.
+			int held = x->op == OpStore ? x->a.val : r;
+			for(int j = i + 1, seen = 0; j < ir->len && seen < window; j++) {
+				Instr *y = &ir->arr[j];
+				if(y->op == OP_DEAD) continue;
+				seen++;
+				if(y->op == OpStore && y->d.val == slot) {
+					// store [m] rA ... store [m] rB: the first store is overwritten unread.
+					if(x->op == OpStore) {
+						x->op = OP_DEAD;
+						removed++, changed = 1;
+					}
+					// load rA [m] ... store [m] rA: memory already holds that value.
+					else if(held != -1 && y->a.val == held) {
+						y->op = OP_DEAD;
+						removed++, changed = 1;
+						continue;
+					}
+					break;
+				}
+				if(y->op == OpLoad && y->a.val == slot) {
+					// store [m] rA ... load rB [m], or a second load: reuse rA.
+					if(held != -1 && forward_operand(ir, j, y->d.val, opd_reg(held), final) == 0) {
+						y->op = OP_DEAD;
+						removed++, changed = 1;
+						continue;
+					}
+					// The slot is read here.
+					break;
+				}
+				if(def_reg(y) == held) {
+					if(x->op == OpLoad) break;
+					held = -1;
+				}
+			}
+		}
+	}
+	free(dead);
+	free(live);
+	// Compact the surviving instructions.
+	int n = 0;
+	for(int i = 0; i < ir->len; i++)
+		if(ir->arr[i].op != OP_DEAD)
+			ir->arr[n++] = ir->arr[i];
+	ir->len = n;
+	return removed;
+}
+
+// Register allocator
+//
+// Code is straight-line, so every definition of a register starts a new value whose live
+// interval runs to its last read. A read with no definition before it (a stale register)
+// starts a value of its own. Intervals are scanned in start order as in Poletto and Sarkar's
+// linear scan; when registers run out the interval ending last is spilled as a whole, and the
+// two highest registers are kept back as scratch for reloading and storing spilled values.
+
+typedef struct _LIVE_RANGES {
+	int n, cap; // number of values
+	int *start, *end;
+	int *va, *vb, *vd; // value read by operand a and b and defined by d at each instruction, or -1
+} LiveRanges;
+
+static int new_value(LiveRanges *lr, int start) {
+	if(lr->n == lr->cap) {
+		lr->cap = lr->cap ? lr->cap * 2 : 256;
+		lr->start = (int*)xrealloc(lr->start, sizeof(int) * lr->cap);
+		lr->end = (int*)xrealloc(lr->end, sizeof(int) * lr->cap);
+	}
+	lr->start[lr->n] = lr->end[lr->n] = start;
+	return lr->n++;
+}
+
+static void live_ranges(IR *ir, LiveRanges *lr) {
+	int lo = 0, hi = 0, len = ir->len;
+	for(int k = 0; k < len; k++) {
+		Operand *o[3] = {&ir->arr[k].d, &ir->arr[k].a, &ir->arr[k].b};
+		for(int t = 0; t < 3; t++)
+			if(o[t]->kind == OpdReg) {
+				if(o[t]->val < lo) lo = o[t]->val;
+				if(o[t]->val > hi) hi = o[t]->val;
+			}
+	}
+	// Current value of every register number, indexed from "lo".
+	int *cur = (int*)xrealloc(NULL, sizeof(int) * (hi - lo + 1));
+	for(int r = 0; r <= hi - lo; r++) cur[r] = -1;
+	memset(lr, 0, sizeof(LiveRanges));
+	lr->va = (int*)xrealloc(NULL, sizeof(int) * (len + 1));
+	lr->vb = (int*)xrealloc(NULL, sizeof(int) * (len + 1));
+	lr->vd = (int*)xrealloc(NULL, sizeof(int) * (len + 1));
+	for(int k = 0; k < len; k++) {
+		Instr *x = &ir->arr[k];
+		Operand *src[2] = {&x->a, &x->b};
+		int *val[2] = {&lr->va[k], &lr->vb[k]};
+		for(int t = 0; t < 2; t++) {
+			*val[t] = -1;
+			if(src[t]->kind != OpdReg) continue;
+			int *v = &cur[src[t]->val - lo];
+			if(*v == -1)
+				*v = new_value(lr, k);
+			lr->end[*v] = k;
+			*val[t] = *v;
+		}
+		lr->vd[k] = -1;
+		if(x->op != OpStore && x->d.kind == OpdReg) {
+			lr->vd[k] = new_value(lr, k);
+			cur[x->d.val - lo] = lr->vd[k];
+		}
+	}
+	free(cur);
+}
+
+// Assign one of "avail" registers to every value, or -1 for a spilled value.
+// Return the largest number of values that were live at once.
+static int linear_scan(LiveRanges *lr, int avail, int *phys) {
+	int *active = (int*)xrealloc(NULL, sizeof(int) * (avail + 1)), n_active = 0, peak = 0;
+	int *free_reg = (int*)xrealloc(NULL, sizeof(int) * (avail + 1)), n_free = 0;
+	for(int r = avail - 1; r >= 0; r--) free_reg[n_free++] = r;
+	for(int v = 0; v < lr->n; v++) {
+		// A value last read by the instruction that defines "v" can hand its register over.
+		int is_def = lr->vd[lr->start[v]] == v;
+		for(int i = 0; i < n_active; ) {
+			int u = active[i];
+			if(lr->end[u] < lr->start[v] || (lr->end[u] == lr->start[v] && is_def)) {
+				free_reg[n_free++] = phys[u];
+				active[i] = active[--n_active];
+			}
+			else i++;
+		}
+		if(n_free > 0) {
+			phys[v] = free_reg[--n_free];
+			active[n_active++] = v;
+		}
+		else {
+			// Spill whichever interval ends last.
+			phys[v] = -1;
+			int far = -1;
+			for(int i = 0; i < n_active; i++)
+				if(far == -1 || lr->end[active[i]] > lr->end[active[far]]) far = i;
+			if(far != -1 && lr->end[active[far]] > lr->end[v]) {
+				int u = active[far];
+				phys[v] = phys[u];
+				phys[u] = -1;
+				active[far] = v;
+			}
+		}
+		if(n_active > peak) peak = n_active;
+	}
+	free(active);
+	free(free_reg);
+	return peak;
+}
+
+static void regalloc(IR *ir, int nregs, int base, RegallocReport *rep) {
+	LiveRanges lr;
+	live_ranges(ir, &lr);
+	int *phys = (int*)xrealloc(NULL, sizeof(int) * (lr.n + 1));
+	// Measure the pressure with a register for everything, then allocate for real.
+	rep->peak = linear_scan(&lr, lr.n + 1, phys);
+	int scratch = nregs;
+	if(rep->peak > nregs) {
+		scratch = nregs - 2;
+		linear_scan(&lr, scratch, phys);
+	}
+	// Give spilled values a slot, reusing the slots of intervals that are over.
+	int *slot = (int*)xrealloc(NULL, sizeof(int) * (lr.n + 1)), *slot_end = NULL;
+	rep->spilled = rep->slots = 0;
+	for(int v = 0; v < lr.n; v++) {
+		if(phys[v] != -1) continue;
+		rep->spilled++;
+		int s = 0;
+		while(s < rep->slots && slot_end[s] >= lr.start[v]) s++;
+		if(s == rep->slots)
+			slot_end = (int*)xrealloc(slot_end, sizeof(int) * ++rep->slots);
+		slot_end[s] = lr.end[v];
+		slot[v] = base + 4 * s;
+	}
+	// Rewrite the registers, reloading spilled reads into the scratch registers before the
+	// instruction and storing a spilled definition right after it.
+	IR saved = *ir;
+	ir->arr = NULL;
+	ir->len = ir->cap = 0;
+	for(int k = 0; k < saved.len; k++) {
+		Instr x = saved.arr[k];
+		Operand *src[2] = {&x.a, &x.b};
+		int val[2] = {lr.va[k], lr.vb[k]};
+		for(int t = 0; t < 2; t++) {
+			if(val[t] == -1) continue;
+			if(phys[val[t]] != -1)
+				src[t]->val = phys[val[t]];
+			else if(t == 1 && val[1] == val[0])
+				src[1]->val = src[0]->val;
+			else {
+				ir_push(ir, OpLoad, opd_reg(scratch + t), opd_mem(slot[val[t]]), opd_none);
+				src[t]->val = scratch + t;
+			}
+		}
+		int v = lr.vd[k];
+		if(v != -1)
+			x.d.val = phys[v] != -1 ? phys[v] : scratch;
+		ir_push(ir, x.op, x.d, x.a, x.b);
+		if(v != -1 && phys[v] == -1)
+			ir_push(ir, OpStore, opd_mem(slot[v]), opd_reg(scratch), opd_none);
+	}
+	free(saved.arr);
+	free(lr.start);
+	free(lr.end);
+	free(lr.va);
+	free(lr.vb);
+	free(lr.vd);
+	free(phys);
+	free(slot);
+	free(slot_end);
+}
+
+// Global value numbering
+//
+// Registers hold values and so do memory slots. A load takes the value number of its slot and
+// a store gives the slot the value number of its register, so assigning or incrementing a
+// variable invalidates every expression over its old value. Codegen reuses register numbers
+// and overwrites them in place, so each definition is renamed to a fresh register first,
+// which keeps every value available for as long as the table remembers it.
+
+static int *grow_minus_one(int *arr, int *cap, int need) {
+	if(need <= *cap) return arr;
+	int old = *cap;
+	while(*cap < need) *cap = *cap ? *cap * 2 : 256;
+	arr = (int*)xrealloc(arr, sizeof(int) * *cap);
+	for(int i = old; i < *cap; i++) arr[i] = -1;
+	return arr;
+}
+
+// The renamed register that codegen register "r" currently stands for.
+static int *gvn_name(Gvn *g, int r) {
+	if(r < -1) r = -1;
+	g->name = grow_minus_one(g->name, &g->name_cap, r + 2);
+	return &g->name[r + 1];
+}
+
+// Give the renamed register "r" the value number "vn".
+static void gvn_set(Gvn *g, int r, int vn) {
+	g->vn = grow_minus_one(g->vn, &g->vn_cap, r + 1);
+	g->vn[r] = vn;
+}
+
+static int *gvn_mem(Gvn *g, int slot) {
+	g->mem = grow_minus_one(g->mem, &g->mem_cap, slot + 1);
+	return &g->mem[slot];
+}
+
+// Rename a read of codegen register "o" and return its value number in "key".
+static void gvn_read(Gvn *g, Operand *o, int *key) {
+	if(o->kind != OpdReg) {
+		*key = o->val;
+		return;
+	}
+	int *name = gvn_name(g, o->val);
+	if(*name == -1) {
+		// Read before any definition: a value nobody knows.
+		*name = g->next_name++;
+		gvn_set(g, *name, g->next_vn++);
+	}
+	o->val = *name;
+	*key = g->vn[*name];
+}
+
+static int gvn(Gvn *g, IR *ir, int from) {
+	int n = from, reused = 0;
+	for(int k = from; k < ir->len; k++) {
+		Instr x = ir->arr[k];
+		int ka = x.a.kind, kb = x.b.kind, a = 0, b = 0;
+		gvn_read(g, &x.a, &a);
+		gvn_read(g, &x.b, &b);
+		if(x.op == OpStore) {
+			*gvn_mem(g, x.d.val) = a;
+			ir->arr[n++] = x;
+			continue;
+		}
+		int vn, holder = -1;
+		if(x.op == OpLoad) {
+			int *m = gvn_mem(g, x.a.val);
+			if(*m == -1) *m = g->next_vn++;
+			vn = *m;
+		}
+		else {
+			// "x+0", "x-0", "x*1" and "x/1" are x itself.
+			if(kb == OpdImm && ((b == 0 && (x.op == OpAdd || x.op == OpSub)) || (b == 1 && (x.op == OpMul || x.op == OpDiv))) && ka == OpdReg)
+				holder = x.a.val;
+			// Commutative operations are keyed with their operands in order.
+			if((x.op == OpAdd || x.op == OpMul) && (ka > kb || (ka == kb && a > b))) {
+				int t = ka; ka = kb; kb = t;
+				t = a; a = b; b = t;
+			}
+			unsigned h = (unsigned)x.op * 31u + (unsigned)ka;
+			h = h * 1000003u + (unsigned)a;
+			h = h * 31u + (unsigned)kb;
+			h = h * 1000003u + (unsigned)b;
+			GvnEntry *e = &g->table[(h ^ (h >> 15)) % GVN_TABLE_SIZE];
+			if(holder != -1)
+				vn = g->vn[holder];
+			else if(e->op == x.op && e->ka == ka && e->a == a && e->kb == kb && e->b == b) {
+				vn = e->vn;
+				holder = e->holder;
+			}
+			else {
+				vn = g->next_vn++;
+				e->op = x.op, e->ka = ka, e->a = a, e->kb = kb, e->b = b;
+				e->vn = vn;
+				e->holder = g->next_name;
+			}
+		}
+		int *name = gvn_name(g, x.d.val);
+		if(holder != -1) {
+			// The value is already in "holder": later reads of the destination go there.
+			*name = holder;
+			reused++;
+			continue;
+		}
+		*name = g->next_name++;
+		x.d.val = *name;
+		gvn_set(g, *name, vn);
+		ir->arr[n++] = x;
+	}
+	ir->len = n;
+	return reused;
+}
+
+// Constant propagation
+//
+// Every register and memory slot has a lattice value that is either a known constant or not
+// constant. Code is straight-line, so values never meet and one forward pass settles them.
+// Slots start out not constant, since x, y and z come from the caller. The state outlives the
+// statement, so after "x = 3" a later "y = x*4+1" loads 3, folds to 13, and only the store
+// to [4] still needs a register.
+
+static ConstValue *const_cell(ConstValue **arr, int *cap, int i) {
+	if(i >= *cap) {
+		int old = *cap;
+		while(*cap <= i) *cap = *cap ? *cap * 2 : 256;
+		*arr = (ConstValue*)xrealloc(*arr, sizeof(ConstValue) * *cap);
+		memset(*arr + old, 0, sizeof(ConstValue) * (*cap - old));
+	}
+	return &(*arr)[i];
+}
+
+static ConstValue const_operand(ConstProp *c, Operand o) {
+	ConstValue v = {0, 0};
+	if(o.kind == OpdImm) {
+		v.known = 1;
+		v.val = o.val;
+	}
+	else if(o.kind == OpdReg && o.val >= -1)
+		v = *const_cell(&c->reg, &c->reg_cap, o.val + 1);
+	return v;
+}
+
+static int constprop(ConstProp *c, IR *ir, int from) {
+	int folded = 0;
+	for(int k = from; k < ir->len; k++) {
+		Instr *x = &ir->arr[k];
+		ConstValue v = {0, 0};
+		if(x->op == OpStore) {
+			*const_cell(&c->mem, &c->mem_cap, x->d.val) = const_operand(c, x->a);
+			continue;
+		}
+		if(x->op == OpLoad)
+			v = *const_cell(&c->mem, &c->mem_cap, x->a.val);
+		else {
+			ConstValue a = const_operand(c, x->a), b = const_operand(c, x->b);
+			if(a.known) x->a = opd_imm(a.val);
+			if(b.known) x->b = opd_imm(b.val);
+			v.known = a.known && b.known && const_eval(x->op, a.val, b.val, &v.val);
+		}
+		if(v.known && (x->op != OpMul || x->a.kind != OpdImm || x->a.val != v.val || x->b.val != 1)) {
+			x->op = OpMul;
+			x->a = opd_imm(v.val);
+			x->b = opd_imm(1);
+			folded++;
+		}
+		if(x->d.val >= -1)
+			*const_cell(&c->reg, &c->reg_cap, x->d.val + 1) = v;
+	}
+	return folded;
+}
+
+// Store sinking
+//
+// Every assignment and increment stores its variable right away, and every statement loads
+// the variables it reads again. Over the whole program a slot's value stays in the register
+// last stored to it or loaded from it until that register is redefined, so a load can read
+// the register instead. A store is then only needed if the slot is loaded again before the
+// next store to it, or if it is the last one, which leaves the final memory unchanged.
+
+static void sink_stores(IR *ir, SinkReport *rep) {
+	int nslots = 0;
+	for(int i = 0; i < ir->len; i++) {
+		int m = mem_slot(&ir->arr[i]);
+		if(m >= nslots) nslots = m + 1;
+	}
+	// Register holding the value of every slot, and the slots that have one.
+	int *holder = (int*)xrealloc(NULL, sizeof(int) * (nslots + 1)), *held = (int*)xrealloc(NULL, sizeof(int) * (nslots + 1));
+	int n_held = 0;
+	char *has = (char*)xrealloc(NULL, nslots + 1);
+	memset(has, 0, nslots + 1);
+	for(int i = 0; i < ir->len; i++) {
+		Instr *x = &ir->arr[i];
+		int m = mem_slot(x);
+		if(x->op == OpLoad && has[m]) {
+			int h = holder[m];
+			if(h == x->d.val || forward_operand(ir, i, x->d.val, opd_reg(h), 1) == 0) {
+				x->op = OP_DEAD;
+				rep->loads++;
+				continue;
+			}
+			// Some read is out of reach: copy the register instead of going to memory.
+			x->op = OpAdd;
+			x->a = opd_reg(h);
+			x->b = opd_imm(0);
+			rep->loads++;
+		}
+		int r = def_reg(x);
+		if(r != -1)
+			for(int k = 0; k < n_held; k++)
+				if(holder[held[k]] == r) {
+					has[held[k]] = 0;
+					held[k--] = held[--n_held];
+				}
+		if(m == -1 || (x->op == OpStore && x->a.kind != OpdReg)) continue;
+		if(!has[m]) {
+			has[m] = 1;
+			held[n_held++] = m;
+		}
+		holder[m] = x->op == OpStore ? x->a.val : r;
+	}
+	// Walking backwards, a store is dead if another store to its slot follows before any load.
+	memset(has, 0, nslots + 1);
+	for(int i = ir->len - 1; i >= 0; i--) {
+		Instr *x = &ir->arr[i];
+		if(x->op == OpLoad)
+			has[x->a.val] = 0;
+		else if(x->op == OpStore) {
+			if(has[x->d.val]) {
+				x->op = OP_DEAD;
+				rep->stores++;
+			}
+			has[x->d.val] = 1;
+		}
+	}
+	int n = 0;
+	for(int i = 0; i < ir->len; i++)
+		if(ir->arr[i].op != OP_DEAD)
+			ir->arr[n++] = ir->arr[i];
+	ir->len = n;
+	free(holder);
+	free(held);
+	free(has);
+}
+
+// Instruction scheduler
+//
+// Codegen walks the tree, so the result of a long div or mul is usually read by the very next
+// instruction. Within a statement the instructions form a dependency DAG: a read of a register
+// or slot waits "latency" cycles for the write before it, and writes stay ordered after the
+// reads and writes before them. List scheduling fills the machine's issue slots cycle by cycle
+// with the ready instruction on the longest latency path to the end of the statement. Values
+// from earlier statements are taken to be ready.
+
+// Edge of the dependency DAG: instruction "to" issues "delay" cycles after "from" at the earliest.
+typedef struct _DEP {
+	int from, to, delay;
+} Dep;
+
+typedef struct _DEP_GRAPH {
+	int n;
+	int *first; // edges leaving instruction i are dep[first[i]] up to dep[first[i+1]]
+	Dep *dep;
+} DepGraph;
+
+static void add_dep(Dep *dep, int *m, int from, int to, int delay) {
+	dep[*m].from = from;
+	dep[*m].to = to;
+	dep[(*m)++].delay = delay;
+}
+
+// Entry of register or slot "r" in the open addressing table "key" of "mask" + 1 entries,
+// claimed if new.
+static int dep_reg(int *key, unsigned mask, int r) {
+	unsigned h = ((unsigned)r * 2654435761u) & mask;
+	while(key[h] != r && key[h] != INT_MIN)
+		h = (h + 1) & mask;
+	key[h] = r;
+	return h;
+}
+
+// Build the dependency DAG of the "n" instructions at "code" from "a".
+static void dep_graph(const MachineDesc *desc, Instr *code, int n, Arena *a, DepGraph *g) {
+	// Register numbers grow over the whole program and slot numbers with the variables, so the
+	// registers and the slots of a statement are hashed into tables at most half full rather
+	// than indexed.
+	unsigned mask = 15;
+	while(mask < 6u * n) mask = mask * 2 + 1;
+	int nregs = mask + 1;
+	int *key = (int*)arena_alloc(a, sizeof(int) * 2 * nregs), *slot_key = key + nregs;
+	for(int i = 0; i < 2 * nregs; i++)
+		key[i] = INT_MIN;
+	// Last write of every register and slot, and the reads since then as lists linked through
+	// "next_read": a register read by operand k of instruction i is entry 2*i+k, a slot read by
+	// a load is entry 2*i.
+	int *def = (int*)arena_alloc(a, sizeof(int) * 2 * nregs), *store = def + nregs;
+	int *reads = (int*)arena_alloc(a, sizeof(int) * 2 * nregs), *loads = reads + nregs;
+	int *next_read = (int*)arena_alloc(a, sizeof(int) * 2 * n);
+	for(int i = 0; i < 2 * nregs; i++)
+		def[i] = reads[i] = -1;
+	// Every read and write adds at most one edge of its own, and every read is ordered before one
+	// write at most, so there are at most 5 edges per instruction.
+	Dep *edge = (Dep*)arena_alloc(a, sizeof(Dep) * 5 * n);
+	int m = 0;
+	for(int i = 0; i < n; i++) {
+		Instr *x = &code[i];
+		Operand *o[2] = {&x->a, &x->b};
+		for(int k = 0; k < 2; k++) {
+			if(o[k]->kind != OpdReg) continue;
+			int r = dep_reg(key, mask, o[k]->val);
+			if(def[r] != -1) add_dep(edge, &m, def[r], i, desc->latency[code[def[r]].op]);
+			next_read[2*i + k] = reads[r];
+			reads[r] = 2*i + k;
+		}
+		int s = mem_slot(x);
+		if(s >= 0) s = dep_reg(slot_key, mask, s);
+		if(x->op == OpLoad && s >= 0) {
+			if(store[s] != -1) add_dep(edge, &m, store[s], i, desc->latency[OpStore]);
+			next_read[2*i] = loads[s];
+			loads[s] = 2*i;
+		}
+		else if(x->op == OpStore && s >= 0) {
+			if(store[s] != -1) add_dep(edge, &m, store[s], i, 0);
+			for(int e = loads[s]; e != -1; e = next_read[e])
+				add_dep(edge, &m, e / 2, i, 0);
+			store[s] = i;
+			loads[s] = -1;
+		}
+		if(x->op != OpStore && x->d.kind == OpdReg) {
+			int r = dep_reg(key, mask, x->d.val);
+			if(def[r] != -1) add_dep(edge, &m, def[r], i, 0);
+			for(int e = reads[r]; e != -1; e = next_read[e])
+				if(e / 2 != i) add_dep(edge, &m, e / 2, i, 0);
+			def[r] = i;
+			reads[r] = -1;
+		}
+	}
+	// Sort the edges by the instruction they leave.
+	g->n = n;
+	g->first = (int*)arena_alloc(a, sizeof(int) * (n + 1));
+	g->dep = (Dep*)arena_alloc(a, sizeof(Dep) * (m + 1));
+	memset(g->first, 0, sizeof(int) * (n + 1));
+	for(int e = 0; e < m; e++)
+		g->first[edge[e].from + 1]++;
+	for(int i = 0; i < n; i++)
+		g->first[i + 1] += g->first[i];
+	int *fill = next_read;
+	memcpy(fill, g->first, sizeof(int) * n);
+	for(int e = 0; e < m; e++)
+		g->dep[fill[edge[e].from]++] = edge[e];
+}
+
+// Stall cycles of issuing the instructions of "g" in the order "order" on "desc". "ready" is
+// scratch for when each one's operands are.
+static long dep_stalls(const MachineDesc *desc, DepGraph *g, const int *order, long *ready) {
+	long stalls = 0, issue = 0;
+	int issued = desc->width;
+	memset(ready, 0, sizeof(long) * g->n);
+	for(int k = 0; k < g->n; k++) {
+		int i = order[k];
+		long slot = issued < desc->width ? issue : issue + 1, t = ready[i] > slot ? ready[i] : slot;
+		stalls += t - slot;
+		if(t == issue) issued++;
+		else {
+			issue = t;
+			issued = 1;
+		}
+		for(int e = g->first[i]; e < g->first[i + 1]; e++)
+			if(t + g->dep[e].delay > ready[g->dep[e].to])
+				ready[g->dep[e].to] = t + g->dep[e].delay;
+	}
+	return stalls;
+}
+
+// Binary heap of instructions, the least "key" first and the earlier instruction among equals.
+static int heap_less(const long *key, int x, int y) {
+	return key[x] < key[y] || (key[x] == key[y] && x < y);
+}
+
+static void heap_push(int *heap, int *len, const long *key, int x) {
+	int i = (*len)++;
+	for(; i > 0 && heap_less(key, x, heap[(i - 1) / 2]); i = (i - 1) / 2)
+		heap[i] = heap[(i - 1) / 2];
+	heap[i] = x;
+}
+
+static int heap_pop(int *heap, int *len, const long *key) {
+	int top = heap[0], x = heap[--*len], i = 0;
+	for(;;) {
+		int child = 2 * i + 1;
+		if(child >= *len) break;
+		if(child + 1 < *len && heap_less(key, heap[child + 1], heap[child])) child++;
+		if(!heap_less(key, heap[child], x)) break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = x;
+	return top;
+}
+
+static void schedule(const MachineDesc *desc, Instr *code, int n, Arena *a, ScheduleReport *rep) {
+	if(n < 2) return;
+	DepGraph g;
+	dep_graph(desc, code, n, a, &g);
+	// Instructions on longer paths go first: "height" is the cycles from an instruction's issue
+	// until the last result of the statement is ready, negated to be a key of the heap.
+	long *height = (long*)arena_alloc(a, sizeof(long) * n), *ready = (long*)arena_alloc(a, sizeof(long) * n);
+	int *npred = (int*)arena_alloc(a, sizeof(int) * n), *order = (int*)arena_alloc(a, sizeof(int) * 2 * n);
+	for(int i = n - 1; i >= 0; i--) {
+		long h = desc->latency[code[i].op];
+		for(int e = g.first[i]; e < g.first[i + 1]; e++)
+			if(g.dep[e].delay + height[g.dep[e].to] > h)
+				h = g.dep[e].delay + height[g.dep[e].to];
+		height[i] = h;
+	}
+	for(int i = 0; i < n; i++)
+		height[i] = -height[i];
+	memset(npred, 0, sizeof(int) * n);
+	for(int e = 0; e < g.first[n]; e++)
+		npred[g.dep[e].to]++;
+	memset(ready, 0, sizeof(long) * n);
+	// Instructions whose predecessors all issued wait in "wait" by the cycle their operands are
+	// ready in, then in "avail" by height.
+	int *wait = (int*)arena_alloc(a, sizeof(int) * n), *avail = (int*)arena_alloc(a, sizeof(int) * n);
+	int nwait = 0, navail = 0, used = 0;
+	for(int i = 0; i < n; i++)
+		if(npred[i] == 0) heap_push(wait, &nwait, ready, i);
+	long t = 1;
+	for(int k = 0; k < n; k++) {
+		for(;;) {
+			while(nwait > 0 && ready[wait[0]] <= t)
+				heap_push(avail, &navail, height, heap_pop(wait, &nwait, ready));
+			if(navail > 0 && used < desc->width) break;
+			// Nothing more can issue in this cycle.
+			t = navail > 0 ? t + 1 : ready[wait[0]];
+			used = 0;
+		}
+		int i = heap_pop(avail, &navail, height);
+		order[k] = i;
+		used++;
+		for(int e = g.first[i]; e < g.first[i + 1]; e++) {
+			Dep *d = &g.dep[e];
+			if(t + d->delay > ready[d->to]) ready[d->to] = t + d->delay;
+			if(--npred[d->to] == 0) heap_push(wait, &nwait, ready, d->to);
+		}
+	}
+	// List scheduling is a heuristic, so compare it with the order codegen chose.
+	int *given = order + n;
+	for(int i = 0; i < n; i++)
+		given[i] = i;
+	long before = dep_stalls(desc, &g, given, ready), after = dep_stalls(desc, &g, order, ready);
+	rep->before += before;
+	if(after >= before) {
+		rep->after += before;
+		return;
+	}
+	rep->after += after;
+	Instr *old = (Instr*)arena_alloc(a, sizeof(Instr) * n);
+	memcpy(old, code, sizeof(Instr) * n);
+	for(int k = 0; k < n; k++) {
+		code[k] = old[order[k]];
+		rep->moved += order[k] != k;
+	}
+}
+
+// Compilation cache
+//
+// Inputs repeat statements, and a statement's code only depends on its tokens and on which
+// variables start out sharing a register: codegen compares register numbers for equality and
+// takes fresh ones from c->reg, which is above all of them. So the code of a statement seen
+// before is replayed with its registers renumbered instead of being compiled again. A
+// statement whose code reads some other register isn't kept, since its meaning depends on more.
+
+// Which of the variables of the statement start out in a register, and which share one:
+// "shape[2 * i]" is -1 if the i-th variable has no register, otherwise the first of them with
+// the same register, and "shape[2 * i + 1]" how many variables hold that register, also
+// variables the statement doesn't name.
+static void cache_shape(Compiler *c, const int *in, int n, int *shape) {
+	for(int i = 0; i < n; i++) {
+		int r = in[i];
+		shape[2 * i] = -1;
+		shape[2 * i + 1] = 0;
+		if(r == -1) continue;
+		shape[2 * i] = i;
+		shape[2 * i + 1] = c->holders[r];
+		if(c->holders[r] > 1)
+			for(int j = 0; j < i; j++)
+				if(in[j] == r) {
+					shape[2 * i] = j;
+					break;
+				}
+	}
+}
+
+static unsigned cache_hash(const Token *arr, int n, const int *shape, int nvars) {
+	unsigned h = 2166136261u;
+	for(int i = 0; i < n; i++) {
+		h = (h ^ (unsigned)arr[i].kind) * 16777619u;
+		h = (h ^ (unsigned)arr[i].param) * 16777619u;
+	}
+	for(int i = 0; i < 2 * nvars; i++)
+		h = (h ^ (unsigned)shape[i]) * 16777619u;
+	return h;
+}
+
+// Take "e" out of the order of use.
+static void cache_unlink(Cache *cache, int e) {
+	CacheEntry *x = &cache->entry[e];
+	if(x->prev != -1) cache->entry[x->prev].next = x->next;
+	else cache->head = x->next;
+	if(x->next != -1) cache->entry[x->next].prev = x->prev;
+	else cache->tail = x->prev;
+}
+
+// Make "e" the most recently used entry.
+static void cache_push_front(Cache *cache, int e) {
+	CacheEntry *x = &cache->entry[e];
+	x->prev = -1;
+	x->next = cache->head;
+	if(cache->head != -1) cache->entry[cache->head].prev = e;
+	else cache->tail = e;
+	cache->head = e;
+}
+
+// List the variables of the "n" tokens at "arr" in "cache", with their registers and shape.
+static void cache_list(Compiler *c, const Token *arr, int n) {
+	Cache *cache = &c->cache;
+	if(c->sym.len > cache->listed_cap) {
+		int cap = cache->listed_cap;
+		cache->listed_cap = c->sym.len * 2;
+		cache->listed = (int*)xrealloc(cache->listed, sizeof(int) * cache->listed_cap);
+		memset(cache->listed + cap, 0, sizeof(int) * (cache->listed_cap - cap));
+	}
+	cache->nvars = 0;
+	for(int i = 0; i < n; i++) {
+		int v = arr[i].param;
+		if(arr[i].kind != Variable || cache->listed[v] == c->line) continue;
+		if(cache->nvars == cache->vars_cap) {
+			cache->vars_cap = cache->vars_cap * 2 + 16;
+			cache->vars = (int*)xrealloc(cache->vars, sizeof(int) * cache->vars_cap);
+			cache->in = (int*)xrealloc(cache->in, sizeof(int) * cache->vars_cap);
+			cache->shape = (int*)xrealloc(cache->shape, sizeof(int) * 2 * cache->vars_cap);
+		}
+		cache->listed[v] = c->line;
+		cache->in[cache->nvars] = c->store[v].val;
+		cache->vars[cache->nvars++] = v;
+	}
+	cache_shape(c, cache->in, cache->nvars, cache->shape);
+}
+
+static CacheEntry *cache_find(Compiler *c, const Token *arr, int n) {
+	Cache *cache = &c->cache;
+	cache_list(c, arr, n);
+	unsigned h = cache_hash(arr, n, cache->shape, cache->nvars);
+	if(cache->bucket != NULL)
+		for(int e = cache->bucket[h & cache->mask]; e != -1; e = cache->entry[e].chain) {
+			CacheEntry *x = &cache->entry[e];
+			// Equal tokens name the same variables in the same order.
+			if(x->hash != h || x->ntokens != n || memcmp(x->tokens, arr, sizeof(Token) * n) != 0 ||
+				memcmp(x->in, cache->shape, sizeof(int) * 2 * x->nvars) != 0)
+				continue;
+			cache_unlink(cache, e);
+			cache_push_front(cache, e);
+			c->report.cache.hits++;
+			return x;
+		}
+	c->report.cache.misses++;
+	return NULL;
+}
+
+// The register that the relative register "r" of a cache entry stands for.
+static int cache_reg(Compiler *c, int base, int r) {
+	if(r == -1) return -1;
+	if(r >= 0) return base + r;
+	return c->store[c->cache.vars[CACHE_STORE(0) - r]].val;
+}
+
+static void cache_replay(Compiler *c, CacheEntry *e) {
+	int base = c->reg;
+	for(int i = 0; i < e->ncode; i++) {
+		Instr x = e->code[i];
+		if(x.d.kind == OpdReg) x.d.val = cache_reg(c, base, x.d.val);
+		if(x.a.kind == OpdReg) x.a.val = cache_reg(c, base, x.a.val);
+		if(x.b.kind == OpdReg) x.b.val = cache_reg(c, base, x.b.val);
+		ir_append(c, x.op, x.d, x.a, x.b);
+	}
+	// The registers the variables start in are read before any of them moves.
+	int *out = c->cache.in;
+	for(int i = 0; i < e->nvars; i++)
+		out[i] = cache_reg(c, base, e->out[i]);
+	for(int i = 0; i < e->nvars; i++)
+		var_set_reg(c, c->cache.vars[i], out[i]);
+	c->reg = base + e->fresh;
+	c->report.simplify += e->simplify;
+	c->report.reassoc += e->reassoc;
+	c->report.cse += e->cse;
+	c->report.schedule.moved += e->schedule.moved;
+	c->report.schedule.before += e->schedule.before;
+	c->report.schedule.after += e->schedule.after;
+}
+
+// Make the register "r" relative to the start of a statement, or return 0 if it can't be.
+static int cache_relative(const Cache *cache, int base, int *r) {
+	if(*r == -1) return 1;
+	if(*r >= base) {
+		*r -= base;
+		return 1;
+	}
+	for(int i = 0; i < cache->nvars; i++)
+		if(cache->in[i] == *r) {
+			*r = CACHE_STORE(i);
+			return 1;
+		}
+	return 0;
+}
+
+static void cache_insert(Compiler *c, const Token *arr, int n, int base, int from, int simplify, int reassoc,
+	int cse, const ScheduleReport *sched) {
+	Cache *cache = &c->cache;
+	int ncode = c->ir.len - from;
+	Instr *code = (Instr*)xrealloc(NULL, sizeof(Instr) * (ncode + 1));
+	int nvars = cache->nvars, ok = 1;
+	// The shape, then the register every variable ends in.
+	int *in = (int*)xrealloc(NULL, sizeof(int) * (3 * nvars + 1)), *out = in + 2 * nvars;
+	for(int i = 0; i < ncode && ok; i++) {
+		Instr *x = &code[i];
+		*x = c->ir.arr[from + i];
+		if(x->d.kind == OpdReg) ok &= cache_relative(cache, base, &x->d.val);
+		if(x->a.kind == OpdReg) ok &= cache_relative(cache, base, &x->a.val);
+		if(x->b.kind == OpdReg) ok &= cache_relative(cache, base, &x->b.val);
+	}
+	for(int i = 0; i < nvars && ok; i++) {
+		out[i] = c->store[cache->vars[i]].val;
+		ok = cache_relative(cache, base, &out[i]);
+	}
+	if(!ok) {
+		free(code);
+		free(in);
+		return;
+	}
+
+	if(cache->entry == NULL) {
+		cache->cap = c->opt.cache;
+		cache->entry = (CacheEntry*)xrealloc(NULL, sizeof(CacheEntry) * cache->cap);
+		unsigned size = 16;
+		while(size < 2u * cache->cap) size *= 2;
+		cache->mask = size - 1;
+		cache->bucket = (int*)xrealloc(NULL, sizeof(int) * size);
+		for(unsigned i = 0; i < size; i++) cache->bucket[i] = -1;
+		cache->head = cache->tail = -1;
+	}
+	int e;
+	if(cache->len < cache->cap)
+		e = cache->len++;
+	else {
+		// Drop the least recently used entry and take its place.
+		e = cache->tail;
+		CacheEntry *old = &cache->entry[e];
+		int *link = &cache->bucket[old->hash & cache->mask];
+		while(*link != e) link = &cache->entry[*link].chain;
+		*link = old->chain;
+		cache_unlink(cache, e);
+		free(old->tokens);
+		free(old->in);
+		free(old->code);
+		c->report.cache.evictions++;
+	}
+	CacheEntry *x = &cache->entry[e];
+	memcpy(in, cache->shape, sizeof(int) * 2 * nvars);
+	x->nvars = nvars;
+	x->in = in;
+	x->out = out;
+	x->hash = cache_hash(arr, n, in, nvars);
+	x->tokens = (Token*)xrealloc(NULL, sizeof(Token) * n);
+	memcpy(x->tokens, arr, sizeof(Token) * n);
+	x->ntokens = n;
+	x->code = code;
+	x->ncode = ncode;
+	x->fresh = c->reg - base;
+	x->simplify = simplify;
+	x->reassoc = reassoc;
+	x->cse = cse;
+	x->schedule = *sched;
+	x->chain = cache->bucket[x->hash & cache->mask];
+	cache->bucket[x->hash & cache->mask] = e;
+	cache_push_front(cache, e);
+}
+
+static void cache_free(Cache *cache) {
+	for(int i = 0; i < cache->len; i++) {
+		free(cache->entry[i].tokens);
+		free(cache->entry[i].in);
+		free(cache->entry[i].code);
+	}
+	free(cache->entry);
+	free(cache->bucket);
+	free(cache->vars);
+	free(cache->in);
+	free(cache->shape);
+	free(cache->listed);
+}
+
+#ifndef COMPILER_NO_MAIN
+// Benchmark
+//
+// The corpora are generated from a seed, so a run compiles the same text on every machine
+// and its throughput can be compared with the runs before a change. Each shape stresses a
+// path whose cost can grow faster than the input: long flat chains, deeply nested parentheses,
+// mixes of ++ and --, assignment chains, and a long program mixing them all. Statements avoid
+// a negated parenthesis, which the parser still rejects.
+// Generating the text isn't timed; compiling it, down to formatting the assembly, is.
+
+typedef struct _TEXT {
+	char *arr;
+	size_t len, cap;
+} Text;
+
+static void text_put(Text *t, const char *s) {
+	size_t n = strlen(s);
+	if(t->len + n > t->cap) {
+		t->cap = t->cap * 2 + n + 4096;
+		t->arr = (char*)xrealloc(t->arr, t->cap);
+	}
+	memcpy(t->arr + t->len, s, n);
+	t->len += n;
+}
+
+// A linear congruential generator, the same everywhere unlike rand().
+static unsigned bench_rand(unsigned *seed, unsigned n) {
+	*seed = *seed * 1103515245u + 12345u;
+	return (*seed >> 16) % n;
+}
+
+// A variable or a number, 0 included.
+static void gen_operand(Text *t, unsigned *seed) {
+	char num[8];
+	if(bench_rand(seed, 2)) {
+		num[0] = "xyz"[bench_rand(seed, 3)];
+		num[1] = '\0';
+	}
+	else
+		sprintf(num, "%u", bench_rand(seed, 100));
+	text_put(t, num);
+}
+
+static const char *const BINOP[] = {" + ", " - ", " * ", " / ", " % "};
+
+static void gen_flat(Text *t, unsigned *seed, int n) {
+	gen_operand(t, seed);
+	for(int i = 1; i < n; i++) {
+		text_put(t, BINOP[bench_rand(seed, 5)]);
+		gen_operand(t, seed);
+	}
+}
+
+// Every pair of parentheses holds an operator, with the deeper pair on a random side, but for
+// the innermost ones, which may hold a lone operand.
+static void gen_nested(Text *t, unsigned *seed, int depth) {
+	if(depth == 0) {
+		int par = bench_rand(seed, 4) == 0;
+		if(par) text_put(t, "(");
+		gen_operand(t, seed);
+		if(par) text_put(t, ")");
+		return;
+	}
+	int op = bench_rand(seed, 5), left = bench_rand(seed, 2);
+	text_put(t, "(");
+	if(left) gen_nested(t, seed, depth - 1);
+	else gen_operand(t, seed);
+	text_put(t, BINOP[op]);
+	if(left) gen_operand(t, seed);
+	else gen_nested(t, seed, depth - 1);
+	text_put(t, ")");
+}
+
+static void gen_incdec(Text *t, unsigned *seed, int n) {
+	static const char *const term[] = {"++x", "++y", "++z", "--x", "--y", "--z",
+		"x++", "y++", "z++", "x--", "y--", "z--", "x", "y", "z"};
+	static const char *const op[] = {" + ", " - ", " * "};
+	for(int i = 0; i < n; i++) {
+		if(i > 0) text_put(t, op[bench_rand(seed, 3)]);
+		text_put(t, term[bench_rand(seed, 15)]);
+	}
+}
+
+static void gen_assign(Text *t, unsigned *seed, int n) {
+	static const char *const lhs[] = {"x = ", "y = ", "z = "};
+	for(int i = 0; i < n; i++)
+		text_put(t, lhs[bench_rand(seed, 3)]);
+	gen_flat(t, seed, 3);
+}
+
+// One statement of the shape "kind", or of a random one when "kind" is -1.
+static void gen_statement(Text *t, unsigned *seed, int kind, int size) {
+	if(kind == -1) {
+		kind = bench_rand(seed, 4);
+		size = 2 + bench_rand(seed, 6);
+	}
+	switch(kind) {
+		case 0:
+			text_put(t, "x = ");
+			gen_flat(t, seed, size);
 			break;
-		case Value:
-			printf(kind_para, TYPE[head->type], "value", head->val);
+		case 1:
+			text_put(t, "y = ");
+			gen_nested(t, seed, size);
 			break;
-		case Variable:
-			printf(kind_para, TYPE[head->type], "name", head->val);
+		case 2:
+			text_put(t, "z = ");
+			gen_incdec(t, seed, size);
 			break;
 		default:
-			puts("Undefined AST Type!");
+			gen_assign(t, seed, size);
+	}
+	text_put(t, "\n");
+}
+
+static int bench(const Options *opt, unsigned seed, int lines) {
+	static const struct {
+		const char *name;
+		int kind, size, lines; // "kind" of gen_statement, and 0 "lines" for the number given
+	} corpus[] = {
+		{"flat", 0, 256, 4000},
+		{"nested", 1, 256, 4000},
+		{"incdec", 2, 16, 200000},
+		{"assign", 3, 32, 100000},
+		{"program", -1, 0, 0},
+	};
+	int fd = open("/dev/null", O_WRONLY);
+	Compiler *c = (Compiler*)malloc(sizeof(Compiler));
+	if(fd == -1) {
+		perror("/dev/null");
+		exit(1);
+	}
+	if(c == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	int failed = 0;
+	for(size_t k = 0; k < sizeof(corpus) / sizeof(corpus[0]); k++) {
+		int n = corpus[k].lines ? corpus[k].lines : lines;
+		unsigned state = seed;
+		Text text = {NULL, 0, 0};
+		for(int i = 0; i < n; i++)
+			gen_statement(&text, &state, corpus[k].kind, corpus[k].size);
+
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		compiler_init(c, opt, fd);
+		int res = compile_text(c, text.arr, text.len);
+		if(res == 0)
+			compiler_finish(c);
+		compiler_free(c);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		free(text.arr);
+
+		double sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		if(sec <= 0) sec = 1e-9;
+		printf("%-8s %8d lines %8.2f MB %8.3f s %12.0f lines/s %8.2f MB/s\n", corpus[k].name, n,
+			text.len / 1e6, sec, n / sec, text.len / 1e6 / sec);
+		fflush(stdout);
+		if(res != 0) {
+			fprintf(stderr, "bench: %s failed to compile\n", corpus[k].name);
+			failed = 1;
+		}
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	printf("peak RSS %ld KB\n", usage.ru_maxrss);
+	free(c);
+	close(fd);
+	return failed;
+}
+#endif
+
+static void write_all(int fd, const char *buf, size_t n) {
+	while(n > 0) {
+		ssize_t k = write(fd, buf, n);
+		if(k < 0) {
+			perror("write");
+			exit(1);
+		}
+		buf += k;
+		n -= k;
+	}
+}
+
+// Format "v" as decimal text at "p" and return the position after it.
+static char *put_int(char *p, int v) {
+	char tmp[12];
+	int n = 0;
+	unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+	do {
+		tmp[n++] = '0' + u % 10;
+		u /= 10;
+	} while(u != 0);
+	if(v < 0) *p++ = '-';
+	while(n > 0) *p++ = tmp[--n];
+	return p;
+}
+
+static char *put_operand(char *p, Operand o) {
+	*p++ = ' ';
+	switch(o.kind) {
+		case OpdReg:
+			*p++ = 'r';
+			return put_int(p, o.val);
+		case OpdImm:
+			return put_int(p, o.val);
+		default:
+			*p++ = '[';
+			p = put_int(p, o.val);
+			*p++ = ']';
+			return p;
 	}
-	AST_print(head->lhs, indent+1);
-	AST_print(head->mid, indent+1);
-	AST_print(head->rhs, indent+1);
-}
\ No newline at end of file
+}
+
+// Format "op d a b" at "p", without the newline, and return the position after it.
+// The longest instruction is "store" plus three 11-digit operands.
+static char *put_instr(char *p, int op, Operand d, Operand a, Operand b) {
+	for(const char *name = OPNAME[op]; *name; name++) *p++ = *name;
+	p = put_operand(p, d);
+	if(a.kind != OpdNone) p = put_operand(p, a);
+	if(b.kind != OpdNone) p = put_operand(p, b);
+	return p;
+}
+
+static void emit(Emitter *out, int op, Operand d, Operand a, Operand b) {
+	if(out->discard) return;
+	if(out->len + 64 > EMIT_BUF_SIZE) emit_flush(out);
+	char *p = put_instr(out->buf + out->len, op, d, a, b);
+	*p++ = '\n';
+	out->len = p - out->buf;
+}
+
+// Simulator
+//
+// Registers and memory slots hold 32-bit values that wrap around like the machine's. Slots are
+// words, so only multiples of 4 can be stored to: [0], [4] and [8] hold x, y and z, the other
+// variables follow in the order they appear, and the register allocator spills past them. Only
+// x, y and z start out set. Reading a register or slot nothing wrote, storing to any other
+// slot, and dividing by zero are faults; the first few are described on stderr.
+
+#define SIM_FAULTS_SHOWN 8
+
+static void sim_fault(Instr *x, SimReport *rep, const char *what) {
+	if(rep->faults++ >= SIM_FAULTS_SHOWN) return;
+	char text[64];
+	*put_instr(text, x->op, x->d, x->a, x->b) = '\0';
+	fprintf(stderr, "simulate: instruction %ld \"%s\": %s\n", rep->instrs, text, what);
+}
+
+// Make room for index "i" in the arrays of a machine register file or memory.
+static void sim_grow(int **val, char **set, long **ready, int *cap, int i) {
+	if(i < *cap) return;
+	int old = *cap;
+	while(*cap <= i) *cap = *cap ? *cap * 2 : 64;
+	*val = (int*)xrealloc(*val, sizeof(int) * *cap);
+	*set = (char*)xrealloc(*set, *cap);
+	*ready = (long*)xrealloc(*ready, sizeof(long) * *cap);
+	memset(*set + old, 0, *cap - old);
+	memset(*ready + old, 0, sizeof(long) * (*cap - old));
+}
+
+// Read operand "o" of "x", raising "*ready" to the cycle its value is available in.
+static int sim_read(Machine *m, Instr *x, Operand o, long *ready, SimReport *rep) {
+	if(o.kind == OpdImm)
+		return o.val;
+	if(o.kind == OpdReg && o.val >= 0) {
+		sim_grow(&m->reg, &m->reg_set, &m->reg_ready, &m->reg_cap, o.val);
+		if(!m->reg_set[o.val]) {
+			sim_fault(x, rep, "register read before being written");
+			return 0;
+		}
+		if(m->reg_ready[o.val] > *ready) *ready = m->reg_ready[o.val];
+		return m->reg[o.val];
+	}
+	if(o.kind == OpdMem && o.val >= 0) {
+		sim_grow(&m->mem, &m->mem_set, &m->mem_ready, &m->mem_cap, o.val);
+		if(!m->mem_set[o.val]) {
+			sim_fault(x, rep, "slot read before being written");
+			return 0;
+		}
+		if(m->mem_ready[o.val] > *ready) *ready = m->mem_ready[o.val];
+		return m->mem[o.val];
+	}
+	sim_fault(x, rep, "no such register or slot");
+	return 0;
+}
+
+static void simulate(Machine *m, Instr *x, SimReport *rep) {
+	// The earliest cycle with an issue slot left.
+	long slot = m->issued < m->desc.width ? m->issue : m->issue + 1, ready = slot;
+	int a = sim_read(m, x, x->a, &ready, rep), b = 0, res = 0;
+	if(x->op != OpLoad && x->op != OpStore)
+		b = sim_read(m, x, x->b, &ready, rep);
+	rep->stalls += ready - slot;
+	if(ready == m->issue)
+		m->issued++;
+	else {
+		m->issue = ready;
+		m->issued = 1;
+	}
+	long done = ready + m->desc.latency[x->op];
+	if(done > rep->cycles) rep->cycles = done;
+	rep->instrs++;
+	if(x->op != OpLoad && x->op != OpStore && !const_eval(x->op, a, b, &res)) {
+		// INT_MIN / -1 wraps around, a division by zero leaves 0.
+		if(b == 0) sim_fault(x, rep, "division by zero");
+		else res = x->op == OpDiv ? INT_MIN : 0;
+	}
+	if(x->op == OpStore) {
+		int slot = x->d.val;
+		if(slot < 0 || slot % 4 != 0) {
+			sim_fault(x, rep, "store to a slot that isn't a word");
+			if(slot < 0) return;
+		}
+		sim_grow(&m->mem, &m->mem_set, &m->mem_ready, &m->mem_cap, slot);
+		m->mem[slot] = a;
+		m->mem_set[slot] = 1;
+		m->mem_ready[slot] = done;
+		return;
+	}
+	if(x->op == OpLoad) res = a;
+	if(x->d.kind != OpdReg || x->d.val < 0) {
+		sim_fault(x, rep, "no such register");
+		return;
+	}
+	sim_grow(&m->reg, &m->reg_set, &m->reg_ready, &m->reg_cap, x->d.val);
+	m->reg[x->d.val] = res;
+	m->reg_set[x->d.val] = 1;
+	m->reg_ready[x->d.val] = done;
+}
+
+#ifndef COMPILER_NO_MAIN
+static void machine_print(Machine *m) {
+	fprintf(stderr, "simulate: memory");
+	for(int i = 0; i < m->mem_cap; i++)
+		if(m->mem_set[i])
+			fprintf(stderr, " [%d]=%d", i, m->mem[i]);
+	fprintf(stderr, "\n");
+}
+#endif
+
+static void emit_flush(Emitter *out) {
+	if(out->fd != -1)
+		write_all(out->fd, out->buf, out->len);
+	else if(out->len > 0) {
+		if(out->mem_len + out->len > out->mem_cap) {
+			while(out->mem_len + out->len > out->mem_cap)
+				out->mem_cap = out->mem_cap ? out->mem_cap * 2 : EMIT_BUF_SIZE;
+			out->mem = (char*)xrealloc(out->mem, out->mem_cap);
+		}
+		memcpy(out->mem + out->mem_len, out->buf, out->len);
+		out->mem_len += out->len;
+	}
+	out->len = 0;
+}
+
+static void *arena_alloc(Arena *a, size_t size) {
+	a->allocs++;
+	size = (size + 15) & ~(size_t)15;
+	ArenaBlock *b = a->cur;
+	// Move on to the next kept block, or chain a new one, when this one is full.
+	while(b == NULL || b->used + size > b->size) {
+		if(b != NULL && b->next != NULL) {
+			b = b->next;
+			b->used = 0;
+			continue;
+		}
+		size_t bsize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+		ArenaBlock *nb = (ArenaBlock*)malloc(sizeof(ArenaBlock) + bsize);
+		if(nb == NULL) {
+			perror("malloc");
+			exit(1);
+		}
+		nb->next = NULL;
+		nb->size = bsize;
+		nb->used = 0;
+		if(b == NULL) a->head = nb;
+		else b->next = nb;
+		b = nb;
+	}
+	a->cur = b;
+	void *res = b->data + b->used;
+	b->used += size;
+	return res;
+}
+
+static void arena_reset(Arena *a) {
+	a->cur = a->head;
+	if(a->cur != NULL) a->cur->used = 0;
+}
+
+static Token *new_token(Compiler *c, int kind, int param) {
+	if(c->tokens.len == c->tokens.cap) {
+		c->tokens.cap = c->tokens.cap ? c->tokens.cap * 2 : 64;
+		c->tokens.arr = (Token*)realloc(c->tokens.arr, sizeof(Token) * c->tokens.cap);
+		if(c->tokens.arr == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	Token *res = &c->tokens.arr[c->tokens.len++];
+	res->kind = kind;
+	res->param = param;
+	return res;
+}
+
+static Node new_AST(Compiler *c, Token *mid) {
+	AstPool *p = &c->ast;
+	// Node 0 is never handed out, but the pool starts empty.
+	if(p->len >= p->cap) {
+		// The arrays share one block, so they move together.
+		int cap = p->cap ? p->cap * 2 : 256;
+		char *mem = (char*)xrealloc(NULL, (sizeof(Node) * 3 + sizeof(int32_t) + sizeof(uint8_t)) * cap);
+		Node *lhs = (Node*)mem, *mid = lhs + cap, *rhs = mid + cap;
+		int32_t *val = (int32_t*)(rhs + cap);
+		uint8_t *type = (uint8_t*)(val + cap);
+		if(p->cap > 0) {
+			memcpy(lhs, p->lhs, sizeof(Node) * p->len);
+			memcpy(mid, p->mid, sizeof(Node) * p->len);
+			memcpy(rhs, p->rhs, sizeof(Node) * p->len);
+			memcpy(val, p->val, sizeof(int32_t) * p->len);
+			memcpy(type, p->type, p->len);
+		}
+		else {
+			// Node 0 has no children and a kind no pass takes.
+			lhs[0] = mid[0] = rhs[0] = val[0] = 0;
+			type[0] = UINT8_MAX;
+		}
+		free(p->lhs);
+		p->lhs = lhs;
+		p->mid = mid;
+		p->rhs = rhs;
+		p->val = val;
+		p->type = type;
+		p->cap = cap;
+		c->report.stats.allocs++;
+	}
+	Node newN = p->len++;
+	c->report.stats.ast_nodes++;
+	LHS(newN) = MID(newN) = RHS(newN) = 0;
+	KIND(newN) = mid->kind;
+	VAL(newN) = mid->param;
+	return newN;
+}
+static int isBinaryOperator(int kind) {
+	int res = getOpLevel(kind);
+	if(res >= 3) return 1;
+	return 0;
+}
+
+static int isOp(int x) {
+	return Mul <= x && x <= Assign;
+}
+
+static int isUnary(int x) {
+	return PostInc <= x && x <= Minus;
+}
+
+static int isPar(int x) {
+	return LPar <= x && x<= RPar;
+}
+
+static int isPlusMinus(int x) {
+	if(x == Plus) return 1;
+	if(x == Minus) return 1;
+	return 0;
+}
+
+static int isOperand(int x) {
+	if(x == Value) return 1;
+	if(x == Variable) return 1;
+	return 0;
+}
+
+static int getOpLevel(int kind) {
+	int res;
+	if(kind <= Variable) res = -1;
+	else if(kind <= PostDec) res = 1;
+	else if(kind <= Minus) res = 2;
+	else if(kind <= Rem) res = 3;
+	else if(kind <= Sub) res = 4;
+	else if(kind <= Assign) res = 14;
+	else res = -1;
+	return res;
+}
+
+// Symbol table
+//
+// Variables are numbered in the order their names first appear, x, y and z being 0, 1 and 2,
+// and variable "v" lives in memory slot 4 * v. The names are kept back to back in one buffer.
+
+static unsigned sym_hash(const char *name, size_t n) {
+	unsigned h = 2166136261u;
+	for(size_t i = 0; i < n; i++)
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+	return h;
+}
+
+static int sym_intern(Compiler *c, const char *name, size_t n) {
+	Symbols *sym = &c->sym;
+	// Keep the table at most half full so probes stay short.
+	if(2u * (sym->len + 1) > sym->mask + 1 || sym->table == NULL) {
+		unsigned size = sym->table == NULL ? 16 : 2 * (sym->mask + 1);
+		free(sym->table);
+		sym->table = (int*)xrealloc(NULL, sizeof(int) * size);
+		memset(sym->table, 0, sizeof(int) * size);
+		sym->mask = size - 1;
+		for(int v = 0; v < sym->len; v++) {
+			unsigned h = sym_hash(sym->text + sym->arr[v].name, sym->arr[v].len) & sym->mask;
+			while(sym->table[h] != 0) h = (h + 1) & sym->mask;
+			sym->table[h] = v + 1;
+		}
+	}
+	unsigned h = sym_hash(name, n) & sym->mask;
+	for(; sym->table[h] != 0; h = (h + 1) & sym->mask) {
+		Symbol *x = &sym->arr[sym->table[h] - 1];
+		if((size_t)x->len == n && memcmp(sym->text + x->name, name, n) == 0)
+			return sym->table[h] - 1;
+	}
+	if(sym->text_len + n > (size_t)sym->text_cap) {
+		sym->text_cap = sym->text_cap * 2 + n + 64;
+		sym->text = (char*)xrealloc(sym->text, sym->text_cap);
+	}
+	if(sym->len == sym->cap) {
+		sym->cap = sym->cap * 2 + 16;
+		sym->arr = (Symbol*)xrealloc(sym->arr, sizeof(Symbol) * sym->cap);
+		c->store = (VarReg*)xrealloc(c->store, sizeof(VarReg) * sym->cap);
+	}
+	int v = sym->len++;
+	memcpy(sym->text + sym->text_len, name, n);
+	sym->arr[v] = (Symbol){sym->text_len, (int)n};
+	sym->text_len += n;
+	sym->table[h] = v + 1;
+	c->store[v] = (VarReg){0, -1};
+	return v;
+}
+
+static void var_set_reg(Compiler *c, int v, int r) {
+	int old = c->store[v].val;
+	if(old == r) return;
+	c->store[v].val = r;
+	if(r >= 0) {
+		if(r >= c->holders_cap) {
+			int cap = c->holders_cap;
+			c->holders_cap = r * 2 + 16;
+			c->holders = (int*)xrealloc(c->holders, sizeof(int) * c->holders_cap);
+			memset(c->holders + cap, 0, sizeof(int) * (c->holders_cap - cap));
+		}
+		c->holders[r]++;
+		if(r > c->var_top) c->var_top = r;
+	}
+	if(old >= 0 && --c->holders[old] == 0 && old == c->var_top)
+		while(c->var_top >= 0 && c->holders[c->var_top] == 0) c->var_top--;
+}
+
+static int var_memory(Compiler *c, Node ast) {
+	while(KIND(ast) != Variable)
+		ast = MID(ast);
+	return VAR_SLOT(VAR(ast));
+}
+
+#ifdef AST_DEBUG
+static void AST_print(Compiler *c, Node head, int indent) {
+	if(head == 0) return;
+	const char kind_only[] = "<%s>\n";
+	const char kind_para[] = "<%s>, <%s = %d>\n";
+	// Pre-order walk on c->frames, the state of a frame being the indent of its node.
+	c->frames.len = 0;
+	new_frame(c, head, indent);
+	while(c->frames.len > 0) {
+		Frame *f = &c->frames.arr[--c->frames.len];
+		head = f->node;
+		indent = f->state;
+		for(int i=0;i<indent;i++) printf("  ");
+		switch(KIND(head)) {
+			case LPar:
+			case RPar:
+			case PostInc:
+			case PostDec:
+			case PreInc:
+			case PreDec:
+			case Plus:
+			case Minus:
+			case Mul:
+			case Div:
+			case Rem:
+			case Add:
+			case Sub:
+			case Assign:
+				printf(kind_only, TYPE[KIND(head)]);
+				break;
+			case Value:
+				printf(kind_para, TYPE[KIND(head)], "value", VAL(head));
+				break;
+			case Variable:
+				printf("<%s>, <name = %.*s>\n", TYPE[KIND(head)], c->sym.arr[VAL(head)].len,
+					c->sym.text + c->sym.arr[VAL(head)].name);
+				break;
+			default:
+				puts("Undefined AST Type!");
+		}
+		// The children go on in reverse, so lhs comes off first.
+		if(RHS(head) != 0) new_frame(c, RHS(head), indent+1);
+		if(MID(head) != 0) new_frame(c, MID(head), indent+1);
+		if(LHS(head) != 0) new_frame(c, LHS(head), indent+1);
+	}
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,14 @@
+# Chains 200000 terms long, nested to the right and running to the left, whose constants fold.
+function rep(s, n,  r) {
+	for(r = ""; n > 0; n = int(n / 2)) {
+		if(n % 2) r = r s
+		s = s s
+	}
+	return r
+}
+BEGIN {
+	n = 200000
+	print "x = " rep("(1+", n) "y" rep(")", n)
+	print "z = y" rep("-2+3*1", n)
+	print "w = " rep("(y*", n) "0" rep(")", n)
+}
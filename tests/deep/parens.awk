@@ -0,0 +1,13 @@
+# A million parentheses around an expression and around a lone operand.
+function rep(s, n,  r) {
+	for(r = ""; n > 0; n = int(n / 2)) {
+		if(n % 2) r = r s
+		s = s s
+	}
+	return r
+}
+BEGIN {
+	n = 1000000
+	print "x = " rep("(", n) "y+1" rep(")", n)
+	print "y = " rep("(", n) "y" rep(")", n) "*2"
+}
@@ -0,0 +1,90 @@
+#!/bin/sh
+# Regression check: compile every tests/cases/NAME.in with the flags of NAME.args, if any, and
+# compare what the compiler prints, stdout and stderr together, with NAME.out. The inputs of
+# tests/deep are printed by NAME.awk instead, being megabytes of nesting. The files of
+# tests/batch are compiled by one multithreaded run and their .s files compared the same way.
+#
+#   tests/run.sh [compiler]
+#
+# Without an argument project_one.c is built first, with $CC and $CFLAGS when they are set, so
+# CFLAGS="-g -fsanitize=address,undefined" fails the cases the sanitizers complain about. It is
+# also built as a library, which must export nothing but the compiler_ functions.
+# UPDATE=1 rewrites the .out files instead, for a change that is meant to alter the output;
+# review their diff before committing it.
+# A case that runs longer than 10 seconds or dies on a signal fails whatever it printed.
+
+dir=$(cd "$(dirname "$0")" && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+if [ $# -ge 1 ]; then
+	bin=$1
+else
+	bin=$tmp/project_one
+	${CC:-cc} ${CFLAGS:--O2} -pthread -o "$bin" "$dir/../project_one.c" || exit 1
+fi
+limit=
+command -v timeout >/dev/null && limit="timeout 10"
+
+pass=0 fail=0
+# Compare $tmp/out, printed by a run that ended with status $2, with the expected output $1.out.
+check() {
+	if [ -n "$UPDATE" ] && [ $2 -lt 124 ]; then
+		cp "$tmp/out" "$1.out"
+	fi
+	if [ $2 -ge 124 ]; then
+		echo "FAIL $(basename "$1"): exit status $2"
+		fail=$((fail + 1))
+	elif ! cmp -s "$tmp/out" "$1.out"; then
+		echo "FAIL $(basename "$1"): output differs"
+		diff "$1.out" "$tmp/out" | head -20
+		fail=$((fail + 1))
+	else
+		pass=$((pass + 1))
+	fi
+}
+
+for in in "$dir"/cases/*.in; do
+	name=${in%.in}
+	args=
+	[ -f "$name.args" ] && args=$(cat "$name.args")
+	$limit "$bin" $args < "$in" > "$tmp/out" 2>&1
+	check "$name" $?
+done
+
+# Nesting this deep overflows the C stack of any pass that recurses on the tree.
+for gen in "$dir"/deep/*.awk; do
+	name=${gen%.awk}
+	args=
+	[ -f "$name.args" ] && args=$(cat "$name.args")
+	awk -f "$gen" > "$tmp/in"
+	$limit "$bin" $args < "$tmp/in" > "$tmp/out" 2>&1
+	check "$name" $?
+done
+
+# The files of tests/batch are compiled in one run on two threads, each into its own .s file,
+# which must hold its code whatever the other files do.
+mkdir "$tmp/batch"
+cp "$dir"/batch/*.in "$tmp/batch"
+$limit "$bin" --jobs=2 "$tmp"/batch/*.in > "$tmp/batch.log" 2>&1
+status=$?
+for in in "$dir"/batch/*.in; do
+	name=${in%.in}
+	cat "$tmp/batch/$(basename "$in").s" > "$tmp/out" 2>/dev/null
+	check "$name" $status
+done
+
+# Built as a library, the compiler must export its entry points only, or it takes over the
+# functions of the host program of the same name.
+if [ $# -eq 0 ] && command -v nm >/dev/null; then
+	${CC:-cc} ${CFLAGS:--O2} -pthread -DCOMPILER_NO_MAIN -c -o "$tmp/lib.o" "$dir/../project_one.c" || exit 1
+	extra=$(nm -g --defined-only "$tmp/lib.o" | awk '$3 !~ /^compiler_/ { print $3 }')
+	if [ -n "$extra" ]; then
+		echo "FAIL library: exports" $extra
+		fail=$((fail + 1))
+	else
+		pass=$((pass + 1))
+	fi
+fi
+
+echo "$pass passed, $fail failed"
+[ $fail -eq 0 ]